@@ -1,65 +1,258 @@
 #include <embree3/rtcore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
 #include <float.h>
+#include <thread>
 
 #include "brdf.h"
 #include "bmp.h"
 #include "geom.h"
 #include "RTObject.h"
+#include "obj.h"
+#include "render.h"
+#include "light.h"
+#include "stats.h"
+
+//Embree reports every allocation and free here
+static bool memory_monitor(void * ptr, ssize_t bytes, bool post) {
+	((RTScene *)ptr)->device_bytes += bytes;
+	return true;
+}
+
+const char * quality_name(RTCBuildQuality q) {
+	switch (q) {
+	case RTC_BUILD_QUALITY_LOW: return "low";
+	case RTC_BUILD_QUALITY_MEDIUM: return "medium";
+	case RTC_BUILD_QUALITY_HIGH: return "high";
+	case RTC_BUILD_QUALITY_REFIT: return "refit";
+	default: return "unknown";
+	}
+}
 
-inline vec3f * eval_ray(RTCRay ray, float t) {
-  return new vec3f(ray.org_x + t * ray.dir_x, ray.org_y + t * ray.dir_y, ray.org_z + t * ray.dir_z);
+inline vec3f eval_ray(const RTCRay & ray, float t) {
+  return vec3f(ray.org_x + t * ray.dir_x, ray.org_y + t * ray.dir_y, ray.org_z + t * ray.dir_z);
 }
 
 RTScene::RTScene() {
 	device = rtcNewDevice("");
 	scene = rtcNewScene(device);
 	cam = new Camera(0.f, 0.f, 0.f, 1.f, 1.f, 1.f, 1.0f, 100, 100);
-	rtcInitIntersectContext(&context);
-	rh.ray.time = 0.f;
-
-	obs = (RTObject **)malloc(64 * sizeof(RTObject *));
+	env = NULL;
+	env_rotation = 0.f; env_intensity = 1.f;
+
+	scene_quality = RTC_BUILD_QUALITY_MEDIUM;
+	geom_quality = RTC_BUILD_QUALITY_MEDIUM;
+	flags = RTC_SCENE_FLAG_NONE;
+	verbose = false;
+	geom_seconds = 0.0; scene_seconds = 0.0;
+	geom_bytes = 0; scene_bytes = 0;
+	device_bytes = 0;
+	rtcSetDeviceMemoryMonitorFunction(device, memory_monitor, this);
+
+	obj_cap = 64;
+	obs = (RTObject **)malloc(obj_cap * sizeof(RTObject *));
+	first_material = (int *)malloc(obj_cap * sizeof(int));
+	prim_materials = (const unsigned char **)malloc(obj_cap * sizeof(unsigned char *));
 	obj_count = 0;
+	Material none;
+	material_init(&none);
+	none.kind = MAT_NONE;
+	materials.add(none);
 }
 
 int RTScene::record_obj(RTObject * obj) {
-	if (obj_count >= 64) return -1;
+	std::lock_guard<std::mutex> hold(lock);
+	if (obj_count >= obj_cap) {
+		//each array that grew is kept, but the capacity only goes up
+		//once all three have
+		RTObject ** o = (RTObject **)realloc(obs, 2 * obj_cap * sizeof(RTObject *));
+		if (o) obs = o;
+		int * f = (int *)realloc(first_material, 2 * obj_cap * sizeof(int));
+		if (f) first_material = f;
+		const unsigned char ** p = (const unsigned char **)realloc(prim_materials, 2 * obj_cap * sizeof(unsigned char *));
+		if (p) prim_materials = p;
+		if (!o || !f || !p) return -1;
+		obj_cap *= 2;
+	}
 	obs[obj_count] = obj;
+	first_material[obj_count] = 0;
+	prim_materials[obj_count] = NULL;
 	obj_count++;
 	return obj_count - 1;
 }
 
+//on failure the object keeps no geometry and its id stays -1, which
+//loadFile and the callers check
+bool RTObject::record(RTScene * s) {
+	id = s->record_obj(this);
+	if (id >= 0) return true;
+	printf("Out of memory adding an object to the scene\n");
+	rtcReleaseGeometry(geom);
+	geom = NULL;
+	return false;
+}
+
+int RTScene::add_materials(const Material * m, int n) {
+	std::lock_guard<std::mutex> hold(lock);
+	int first = materials.n;
+	for (int i = 0; i < n; i++) materials.add(m[i]);
+	return first;
+}
+
+//prim_offsets, if any, must outlive the scene
+void RTScene::set_material(int id, int first, const unsigned char * prim_offsets) {
+	std::lock_guard<std::mutex> hold(lock);
+	first_material[id] = first;
+	prim_materials[id] = prim_offsets;
+}
+
+int RTScene::add_mesh(char * fname, vec3f c, const Material & m) {
+	RTTriangleMesh * mesh = new RTTriangleMesh(this, m, emit_black);
+	mesh->albedo = c;
+	if (mesh->loadFile(fname) < 0) return -1;
+	return mesh->id;
+}
+
+//commit a loaded object's geometry and add it to the scene. the
+//commits run unlocked, so loader threads build prototypes side by
+//side; their byte counts then include each other's allocations
+void RTScene::attach(RTObject * obj) {
+	long b0 = device_bytes;
+	double t0 = wall_time();
+	rtcSetGeometryBuildQuality(obj->geom, obj->quality);
+	rtcCommitGeometry(obj->geom);
+	if (obj->proto) {
+		//prototypes get their BVH now, once, however often they are placed
+		rtcAttachGeometryByID(obj->proto, obj->geom, 0);
+		rtcSetSceneBuildQuality(obj->proto, obj->quality);
+		rtcSetSceneFlags(obj->proto, flags);
+		rtcCommitScene(obj->proto);
+	}
+	double t = wall_time() - t0;
+	long b = device_bytes - b0;
+
+	std::lock_guard<std::mutex> hold(lock);
+	if (!obj->proto) rtcAttachGeometryByID(scene, obj->geom, obj->id);
+	geom_seconds += t;
+	geom_bytes += b;
+	if (verbose) {
+		printf("Committed geometry %d (%s quality) in %.2f ms, %.2f MB\n", obj->id,
+			quality_name(obj->quality), t * 1e3, b / 1048576.0);
+	}
+}
+
 void RTScene::commit() {
+	rtcSetSceneBuildQuality(scene, scene_quality);
+	rtcSetSceneFlags(scene, flags);
+
+	long b0 = device_bytes;
+	double t0 = wall_time();
 	rtcCommitScene(scene);
+	scene_seconds = wall_time() - t0;
+	scene_bytes = device_bytes - b0;
+	if (verbose) {
+		printf("Committed scene (%s quality) in %.2f ms, %.2f MB\n",
+			quality_name(scene_quality), scene_seconds * 1e3, scene_bytes / 1048576.0);
+	}
+}
+
+void RTScene::set_quality(RTCBuildQuality scene_q, RTCBuildQuality geom_q) {
+	scene_quality = scene_q;
+	geom_quality = geom_q;
+}
+
+void RTScene::set_flags(RTCSceneFlags f) {
+	flags = f;
 }
 
-void RTScene::resetRH() {
-  rh.ray.tnear = 0.01f;
-  rh.ray.tfar = FLT_MAX; rh.ray.id = 0;
-  rh.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-  rh.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+void RTScene::resetRH(RTCRayHit * rh) {
+  rh->ray.tnear = 0.01f; rh->ray.time = 0.f;
+  rh->ray.tfar = FLT_MAX; rh->ray.id = 0;
+  rh->ray.mask = -1; rh->ray.flags = 0;
+  rh->hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+  rh->hit.geomID = RTC_INVALID_GEOMETRY_ID;
 }
 
-void RTScene::resetR() {
-  rh.ray.tnear = 0.01f;
-  rh.ray.tfar = FLT_MAX; rh.ray.id = 0;
+void RTScene::resetR(RTCRayHit * rh) {
+  rh->ray.tnear = 0.01f;
+  rh->ray.tfar = FLT_MAX; rh->ray.id = 0;
 }
 
+//releases the objects too, so a scene can be dropped without ending
+//the process
 void RTScene::cleanup() {
 	for (int i = 0; i < obj_count; i++) {
-		rtcReleaseGeometry(obs[i]->geom);
+		if (obs[i]->geom) rtcReleaseGeometry(obs[i]->geom);
+		if (obs[i]->proto) rtcReleaseScene(obs[i]->proto);
 	}
 	rtcReleaseScene(scene);
 	rtcReleaseDevice(device);
+	//meshes may hold the mappings Embree's buffers pointed into
+	for (int i = 0; i < obj_count; i++) {
+		delete obs[i];
+	}
+	obj_count = 0;
+	free(obs);
+	free(first_material);
+	free(prim_materials);
+	obs = NULL;
+	first_material = NULL;
+	prim_materials = NULL;
+	delete env;
+	env = NULL;
+	delete cam;
+	cam = NULL;
+}
+
+long RTScene::memory() {
+	long b = device_bytes + (env ? (long)env->bytes : 0);
+	std::lock_guard<std::mutex> hold(lock);
+	for (int i = 0; i < obj_count; i++) {
+		RTSkyBox * sky = dynamic_cast<RTSkyBox *>(obs[i]);
+		RTTriangleMesh * mesh = dynamic_cast<RTTriangleMesh *>(obs[i]);
+		if (sky) b += sky->sides.bytes + sky->bottom.bytes + sky->top.bytes;
+		if (mesh && mesh->cached) b += mesh->file_size;
+	}
+	return b;
+}
+
+//.pfm files are read as portable float maps, anything else as Radiance
+int RTScene::set_hdri(char * fname, float rotation, float intensity) {
+	Texture * t = new Texture();
+	char * ext = strrchr(fname, '.');
+	int ret = ext && !strcasecmp(ext, ".pfm") ? t->load_pfm(fname) : t->load_hdr(fname);
+	if (ret < 0) {
+		delete t;
+		return -1;
+	}
+	delete env;
+	env = t;
+	env_rotation = rotation;
+	env_intensity = intensity;
+	return 0;
+}
+
+//+y is up; s = 0.5 looks down -z and t = 0 is the zenith
+vec3f RTScene::environment(const vec3f & dir, float angle) const {
+	if (!env) return vec3f(0.f, 0.f, 0.f);
+	STAT_INC(STAT_ENV_LOOKUPS);
+	float len = dir.abs();
+	float phi = atan2f(dir.x, -dir.z) + env_rotation;
+	float s = phi * (float)(0.5 / M_PI) + 0.5f;
+	s -= floorf(s);
+	float t = acosf(fminf(fmaxf(dir.y / len, -1.f), 1.f)) * (float)(1.0 / M_PI);
+	return env->lookup(s, t, angle * env->width * (float)(0.5 / M_PI)) * env_intensity;
 }
 
 void RTScene::move(float x, float y, float z) {
-	cam->move(new vec3f(x, y, z));
+	cam->move(vec3f(x, y, z));
 }
 
 void RTScene::point(float x, float y, float z) {
-	cam->point(new vec3f(x, y, z));
+	cam->point(vec3f(x, y, z));
 }
 
 void RTScene::zoom(float theta) {
@@ -70,123 +263,270 @@ void RTScene::resize(int w, int h) {
 	cam->resize(w, h);
 }
 
-vec3f * RTScene::hitP() {
-	return eval_ray(rh.ray, rh.ray.tfar);
+vec3f RTScene::hitP(RTCRayHit * rh) {
+	return eval_ray(rh->ray, rh->ray.tfar);
 }
 
-vec3f * RTScene::hitN() {
-	vec3f * result = new vec3f(rh.hit.Ng_x, rh.hit.Ng_y, rh.hit.Ng_z);
-	result->normalize();
+vec3f RTScene::hitN(RTCRayHit * rh) {
+	vec3f result(rh->hit.Ng_x, rh->hit.Ng_y, rh->hit.Ng_z);
+	//Embree leaves instanced normals in object space
+	if (rh->hit.instID[0] != RTC_INVALID_GEOMETRY_ID) {
+		result = ((RTInstance *)obs[rh->hit.instID[0]])->normal(result);
+	}
+	result.normalize();
 	return result;
 }
 
-vec3f * RTScene::color(int id, int prim, float u, float v) {
-	return obs[id]->color(prim, u, v);
+vec3f RTScene::color(int id, int prim, float u, float v, float width) {
+	STAT_INC(STAT_COLOR_CALLS);
+	STAT_TIMER(TIMER_COLOR);
+	return obs[id]->color(prim, u, v, width);
+}
+
+vec3f RTScene::emit(int id, int prim, float u, float v, float width) {
+	STAT_INC(STAT_EMIT_CALLS);
+	STAT_TIMER(TIMER_EMIT);
+	return obs[id]->emit(prim, u, v, width);
+}
+
+//counting sort of the batch by geomID; misses are left out
+void RTScene::group(RTHitBatch * b) {
+	if (b->n_counts < obj_count + 1) {
+		b->counts = (int *)realloc(b->counts, (obj_count + 1) * sizeof(int));
+		b->n_counts = obj_count + 1;
+	}
+	int * counts = b->counts;
+	for (int i = 0; i <= obj_count; i++) counts[i] = 0;
+	for (int i = 0; i < b->n; i++) {
+		if (b->geomID[i] != RTC_INVALID_GEOMETRY_ID) counts[b->geomID[i] + 1]++;
+	}
+
+	b->n_runs = 0;
+	for (int i = 0; i < obj_count; i++) {
+		if (counts[i + 1] > 0) b->runs[b->n_runs++] = counts[i];
+		counts[i + 1] += counts[i];
+	}
+	b->runs[b->n_runs] = counts[obj_count];
+
+	for (int i = 0; i < b->n; i++) {
+		if (b->geomID[i] != RTC_INVALID_GEOMETRY_ID) b->order[counts[b->geomID[i]]++] = i;
+	}
+}
+
+void RTScene::color_batch(RTHitBatch * b, RTColorBatch * out) {
+	STAT_TIMER(TIMER_COLOR);
+	for (int r = 0; r < b->n_runs; r++) {
+		int * idx = b->order + b->runs[r];
+		STAT_ADD(STAT_COLOR_CALLS, b->runs[r + 1] - b->runs[r]);
+		obs[b->geomID[idx[0]]]->color_batch(b, idx, b->runs[r + 1] - b->runs[r], out);
+	}
+}
+
+void RTScene::emit_batch(RTHitBatch * b, RTColorBatch * out) {
+	STAT_TIMER(TIMER_EMIT);
+	for (int r = 0; r < b->n_runs; r++) {
+		int * idx = b->order + b->runs[r];
+		STAT_ADD(STAT_EMIT_CALLS, b->runs[r + 1] - b->runs[r]);
+		obs[b->geomID[idx[0]]]->emit_batch(b, idx, b->runs[r + 1] - b->runs[r], out);
+	}
 }
 
-float RTScene::reflect(int id, int prim, float theta_i, float phi_i, float theta_o, float phi_o) {
-	return obs[id]->reflect(prim, theta_i, phi_i, theta_o, phi_o);
+//fallbacks for objects without their own batch code
+void RTObject::color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	for (int k = 0; k < n; k++) {
+		int i = idx[k];
+		vec3f c = color(b->primID[i], b->u[i], b->v[i], b->width[i]);
+		out->r[i] = c.x; out->g[i] = c.y; out->b[i] = c.z;
+	}
 }
 
-vec3f * RTScene::emit(int id, int prim, float u, float v) {
-	return obs[id]->emit(prim, u, v);
+void RTObject::emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	for (int k = 0; k < n; k++) {
+		int i = idx[k];
+		vec3f c = emit(b->primID[i], b->u[i], b->v[i], b->width[i]);
+		out->r[i] = c.x; out->g[i] = c.y; out->b[i] = c.z;
+	}
 }
 
-RTTriangleMesh::RTTriangleMesh(RTScene * s, brdf_t m, emit_t b) {
+RTTriangleMesh::RTTriangleMesh(RTScene * s, const Material & m, emit_t b, bool prototype) {
 	device = &(s->device);
 	scene = &(s->scene);
+	parent = s;
+	quality = s->geom_quality;
 	geom = rtcNewGeometry(*device, RTC_GEOMETRY_TYPE_TRIANGLE);
+	proto = prototype ? rtcNewScene(*device) : NULL;
 	num_vertices = 0;
 	num_triangles = 0;
-	material = m;
+	file_size = 0;
+	use_cache = true;
+	cached = false;
+	cache = NULL;
+	albedo = vec3f(1.f, 1.f, 1.f);
+	parse_threads = std::thread::hardware_concurrency();
 	emission = b;
-	id = s->record_obj(this);
+	if (!record(s)) return;
+	s->set_material(id, s->add_materials(&m, 1), NULL);
+}
+
+RTTriangleMesh::~RTTriangleMesh() {
+	delete cache;
 }
 
-void RTTriangleMesh::loadFile(char * fname) {
-  FILE * in = fopen(fname, "r");
-  char * line = NULL; size_t len = 0; ssize_t nread;
-  while ((nread = getline(&line, &len, in)) != -1) {
-    if (line[0] == 'v') num_vertices++;
-    if (line[0] == 'f') num_triangles++;
-  }
-  free(line);
+//a mesh that could not be loaded keeps no geometry
+int RTTriangleMesh::loadFailed() {
+	if (geom) rtcReleaseGeometry(geom);
+	geom = NULL;
+	return -1;
+}
+
+int RTTriangleMesh::loadFile(char * fname) {
+	if (id < 0) return -1;
+	if (is_mesh_cache(fname)) return loadCache(fname) < 0 ? loadFailed() : 0;
+
+	//a cache beside the OBJ saves parsing it again
+	char cname[4096];
+	mesh_cache_name(fname, cname, sizeof(cname));
+	if (use_cache && mesh_cache_fresh(fname, cname) && loadCache(cname) == 0) return 0;
+
+	ObjFile obj;
+	if (obj.open(fname, parse_threads) < 0) return loadFailed();
+	num_vertices = obj.num_vertices;
+	num_triangles = obj.num_triangles;
+	file_size = obj.size;
+	if (num_triangles == 0 || num_vertices == 0) {
+		printf("%s has no triangles\n", fname);
+		return loadFailed();
+	}
+
+	Vertex * vertices  = (Vertex*) rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(Vertex), num_vertices);
+	Triangle * triangles = (Triangle*) rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, sizeof(Triangle), num_triangles);
+	if (obj.parse(vertices, triangles) < 0) {
+		printf("Could not load %s\n", fname);
+		return loadFailed();
+	}
+
+	//best effort; the directory may well be read-only
+	if (use_cache) write_mesh_cache(cname, vertices, num_vertices, triangles, num_triangles);
+
+	parent->attach(this);
+	return 0;
+}
+
+//map a cache file and let Embree use the mapping as-is
+int RTTriangleMesh::loadCache(char * fname) {
+	cache = new MeshCache;
+	if (cache->open(fname) < 0) {
+		delete cache;
+		cache = NULL;
+		return -1;
+	}
+	const MeshCacheHeader * h = cache->header;
+	num_vertices = h->num_vertices;
+	num_triangles = h->num_triangles;
+	file_size = cache->size;
+	cached = true;
+
+	rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, cache->base, h->vertex_offs, sizeof(Vertex), num_vertices);
+	rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, cache->base, h->index_offs, sizeof(Triangle), num_triangles);
+
+	parent->attach(this);
+	return 0;
+}
 
-  Vertex * vertices  = (Vertex*) rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(Vertex), num_vertices);
-  Triangle * triangles = (Triangle*) rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, sizeof(Triangle), num_triangles);
+vec3f RTTriangleMesh::color(int id, float u, float v, float width) {
+	return albedo;
+}
 
-  line = NULL; len = 0; fseek(in, 0L, SEEK_SET);
-  char fn[100]; int v_index = 0, f_index = 0;
-  float x, y, z; int u, v, w;
-  while ((nread = getline(&line, &len, in)) != -1) {
-    if (line[0] == 'v') {
-      sscanf(line, "%s %f %f %f", fn, &x, &y, &z);
-      vertices[v_index].x = x; vertices[v_index].y = y; vertices[v_index].z = z;
-      v_index++;
-    } else if (line[0] == 'f') {
-      sscanf(line, "%s %d %d %d", fn, &u, &v, &w);
-      triangles[f_index].v0 = u - 1; triangles[f_index].v1 = v - 1; triangles[f_index].v2 = w - 1;
-      f_index++;
-    }
-  }
+vec3f RTTriangleMesh::emit(int id, float u, float v, float width) {
+	//a batch of one
+	unsigned int prim = id; int idx = 0;
+	float r, g, b;
+	RTHitBatch one;
+	one.n = 1; one.primID = &prim; one.u = &u; one.v = &v; one.width = &width;
+	RTColorBatch out = {&r, &g, &b};
+	emission(&one, &idx, 1, &out);
+	return vec3f(r, g, b);
+}
 
-  rtcCommitGeometry(geom);
-  rtcAttachGeometryByID(*scene, geom, id);
-  fclose(in);
+void RTTriangleMesh::color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	for (int k = 0; k < n; k++) {
+		int i = idx[k];
+		out->r[i] = albedo.x; out->g[i] = albedo.y; out->b[i] = albedo.z;
+	}
 }
 
-vec3f * RTTriangleMesh::color(int id, float u, float v) {
-	return new vec3f(1.f, 1.f, 1.f);
+void RTTriangleMesh::emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	emission(b, idx, n, out);
 }
 
-float RTTriangleMesh::reflect(int id, float theta_i, float phi_i, float theta_o, float phi_o) {
-	return material(theta_i, phi_i, theta_o, phi_o);
+RTInstance::RTInstance(RTScene * s, RTObject * p, const matrix3f & m, vec3f t) {
+	device = &(s->device);
+	scene = &(s->scene);
+	parent = s;
+	quality = s->geom_quality;
+	geom = rtcNewGeometry(*device, RTC_GEOMETRY_TYPE_INSTANCE);
+	proto = NULL;
+	prototype = p;
+	rtcSetGeometryInstancedScene(geom, p->proto);
+	setTransform(m, t);
+	if (!record(s)) return;
+	//hits on an instance are shaded as its prototype's
+	s->set_material(id, s->material_index(p->id, 0), NULL);
+	parent->attach(this);
 }
 
-vec3f * RTTriangleMesh::emit(int id, float u, float v) {
-	return emission(id, u, v);
+//call RTScene::attach or rtcCommitGeometry afterwards
+void RTInstance::setTransform(const matrix3f & m, vec3f t) {
+	xfm = m;
+	offset = t;
+	normal_xfm = m.inverse().transpose();
+
+	float x[12];
+	for (int j = 0; j < 3; j++) {
+		for (int i = 0; i < 3; i++) {
+			x[j * 3 + i] = m.at(i, j);
+		}
+	}
+	x[9] = t.x; x[10] = t.y; x[11] = t.z;
+	rtcSetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT3X4_COLUMN_MAJOR, x);
 }
 
-RTSkyBox::RTSkyBox(RTScene * s, float l, vec3f *p) {
+RTSkyBox::RTSkyBox(RTScene * s, float l, vec3f p) {
 	device = &(s->device);
 	scene = &(s->scene);
+	parent = s;
+	quality = s->geom_quality;
 	geom = rtcNewGeometry(*device, RTC_GEOMETRY_TYPE_TRIANGLE);
+	proto = NULL;
 	len = l; pos = p;
-	id = s->record_obj(this);
+	if (!record(s)) return;
+
+	//the grass is lambertian, the other faces only emit
+	static const unsigned char faces[12] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0};
+	Material m[2];
+	material_init(&m[0]);
+	material_init(&m[1]);
+	m[0].kind = MAT_NONE;
+	s->set_material(id, s->add_materials(m, 2), faces);
 }
 
-void RTSkyBox::loadFile(char * sname, char * bname, char * tname, int w, int h) {
-	texw = w; texh = h;
-
-	s_red = (unsigned char*)malloc(w*h);
-	s_green = (unsigned char*)malloc(w*h);
-	s_blue = (unsigned char*)malloc(w*h);
-
-	b_red = (unsigned char*)malloc(w*h);
-	b_green = (unsigned char*)malloc(w*h);
-	b_blue = (unsigned char*)malloc(w*h);
-
-	t_red = (unsigned char*)malloc(w*h);
-	t_green = (unsigned char*)malloc(w*h);
-	t_blue = (unsigned char*)malloc(w*h);
-	
-	read_bmp(s_red, s_green, s_blue, w, h, sname);
-	read_bmp(b_red, b_green, b_blue, w, h, bname);
-	read_bmp(t_red, t_green, t_blue, w, h, tname);
+int RTSkyBox::loadFile(char * sname, char * bname, char * tname) {
+	if (id < 0) return -1;
+	if (sides.load_bmp(sname) < 0 || bottom.load_bmp(bname) < 0 || top.load_bmp(tname) < 0) return -1;
 
   Vertex * vertices  = (Vertex*) rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(Vertex), 8);
   Triangle * triangles = (Triangle*) rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, sizeof(Triangle), 12);
 	
 	float l2 = len / 2.f;
 
-	vertices[0].x = -l2 + pos->x; vertices[0].y = -l2 + pos->y; vertices[0].z = -l2 + pos->z;
-  vertices[1].x = -l2 + pos->x; vertices[1].y = -l2 + pos->y; vertices[1].z = l2 + pos->z;
-  vertices[2].x = -l2 + pos->x; vertices[2].y = l2 + pos->y; vertices[2].z = -l2 + pos->z;
-  vertices[3].x = -l2 + pos->x; vertices[3].y = l2 + pos->y; vertices[3].z = l2 + pos->z;
-  vertices[4].x = l2 + pos->x; vertices[4].y = -l2 + pos->y; vertices[4].z = -l2 + pos->z;
-  vertices[5].x = l2 + pos->x; vertices[5].y = -l2 + pos->y; vertices[5].z = l2 + pos->z;
-  vertices[6].x = l2 + pos->x; vertices[6].y = l2 + pos->y; vertices[6].z = -l2 + pos->z;
-  vertices[7].x = l2 + pos->x; vertices[7].y = l2 + pos->y; vertices[7].z = l2 + pos->z;
+	vertices[0].x = -l2 + pos.x; vertices[0].y = -l2 + pos.y; vertices[0].z = -l2 + pos.z;
+  vertices[1].x = -l2 + pos.x; vertices[1].y = -l2 + pos.y; vertices[1].z = l2 + pos.z;
+  vertices[2].x = -l2 + pos.x; vertices[2].y = l2 + pos.y; vertices[2].z = -l2 + pos.z;
+  vertices[3].x = -l2 + pos.x; vertices[3].y = l2 + pos.y; vertices[3].z = l2 + pos.z;
+  vertices[4].x = l2 + pos.x; vertices[4].y = -l2 + pos.y; vertices[4].z = -l2 + pos.z;
+  vertices[5].x = l2 + pos.x; vertices[5].y = -l2 + pos.y; vertices[5].z = l2 + pos.z;
+  vertices[6].x = l2 + pos.x; vertices[6].y = l2 + pos.y; vertices[6].z = -l2 + pos.z;
+  vertices[7].x = l2 + pos.x; vertices[7].y = l2 + pos.y; vertices[7].z = l2 + pos.z;
 
 	int tri = 0;
 
@@ -215,46 +555,70 @@ void RTSkyBox::loadFile(char * sname, char * bname, char * tname, int w, int h)
   triangles[tri].v0 = 1; triangles[tri].v1 = 3; triangles[tri].v2 = 5; tri++;
 
 
-	rtcCommitGeometry(geom);
-	rtcAttachGeometryByID(*scene, geom, id);
+	parent->attach(this);
+	return 0;
 }
 
-vec3f * RTSkyBox::color(int id, float u, float v) {
+//the four sides and the top emit; each is a pair of triangles
+void RTSkyBox::add_lights(RTLights * l) {
+	Vertex * vertices = (Vertex*) rtcGetGeometryBufferData(geom, RTC_BUFFER_TYPE_VERTEX, 0);
+	Triangle * triangles = (Triangle*) rtcGetGeometryBufferData(geom, RTC_BUFFER_TYPE_INDEX, 0);
+	const int faces[5] = {0, 2, 4, 6, 10};
+
+	for (int f = 0; f < 5; f++) {
+		Triangle * t = &triangles[faces[f] + 1];
+		vec3f q(vertices[t->v0].x, vertices[t->v0].y, vertices[t->v0].z);
+		vec3f a(vertices[t->v1].x, vertices[t->v1].y, vertices[t->v1].z);
+		vec3f b(vertices[t->v2].x, vertices[t->v2].y, vertices[t->v2].z);
+		l->add_quad(id, faces[f], faces[f] + 1, q, a - q, b - q);
+	}
+}
+
+//width / len is the footprint as a fraction of a face
+vec3f RTSkyBox::color(int id, float u, float v, float width) {
 	if (id == 8 || id == 9) {
 		v = 1.f - v;
 		if (id == 9) {u = 1.f - u; v = 1.f - v;}
-		int p = (int)(u*texw); 
-		int q = (int)(v*texh);
-		return new vec3f((float)b_red[q * texw + p] / 255.f, (float)b_green[q * texw + p] / 255.f, (float)b_blue[q * texw + p] / 255.f);
+		return bottom.lookup(u, v, width / len * bottom.width);
 	}
-	return new vec3f(0.f, 0.f, 0.f);
+	return vec3f(0.f, 0.f, 0.f);
 }
 
-float RTSkyBox::reflect(int id, float theta_i, float phi_i, float theta_o, float phi_o) {
-	if (id == 8 || id == 9) return 1.f;
-	return 0.f;
-}
-
-vec3f * RTSkyBox::emit(int id, float u, float v) {
+vec3f RTSkyBox::emit(int id, float u, float v, float width) {
 	v = 1.f - v;
 	if (id % 2 == 1) {u = 1.f - u; v = 1.f - v;}
 
 	if (id <= 7) {
-		int h_offs = (id / 2) * (texw / 4);
-		int p = (int)(u*texw / 4 + h_offs);
-		int q = (int)(v*texh);
-		return new vec3f((float)s_red[q * texw + p] / 255.f, (float)s_green[q * texw + p] / 255.f, (float)s_blue[q * texw + p] / 255.f);
+		float s = (u + (float)(id / 2)) * 0.25f;
+		return sides.lookup(s, v, width / len * sides.width * 0.25f);
 	}
 
 	if (id == 8 || id == 9) {
-		return new vec3f(0.f, 0.f, 0.f);
+		return vec3f(0.f, 0.f, 0.f);
 	}
 
 	if (id == 10 || id == 11) {
 		v = 1.f - v;
 		if (id == 11) {u = 1.f - u; v = 1.f - v;}
-		int p = (int)(u*texw); 
-		int q = (int)(v*texh);
-		return new vec3f((float)t_red[q * texw + p] / 255.f, (float)t_green[q * texw + p] / 255.f, (float)t_blue[q * texw + p] / 255.f);
+		return top.lookup(u, v, width / len * top.width);
+	}
+
+	return vec3f(0.f, 0.f, 0.f);
+}
+
+//the qualified calls below are direct, so the per-hit work inlines
+void RTSkyBox::color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	for (int k = 0; k < n; k++) {
+		int i = idx[k];
+		vec3f c = RTSkyBox::color(b->primID[i], b->u[i], b->v[i], b->width[i]);
+		out->r[i] = c.x; out->g[i] = c.y; out->b[i] = c.z;
+	}
+}
+
+void RTSkyBox::emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	for (int k = 0; k < n; k++) {
+		int i = idx[k];
+		vec3f c = RTSkyBox::emit(b->primID[i], b->u[i], b->v[i], b->width[i]);
+		out->r[i] = c.x; out->g[i] = c.y; out->b[i] = c.z;
 	}
 }
@@ -2,94 +2,195 @@
 #define __RTOBJECT_H
 
 #include <embree3/rtcore.h>
+#include <atomic>
+#include <mutex>
 
 #include "geom.h"
 #include "brdf.h"
+#include "batch.h"
+#include "meshcache.h"
+#include "texture.h"
 
 class RTObject;
+class RTLights;
 
-//encapsulates scene, device, rayhit, context
+//encapsulates scene, device, camera
 //not to be confused with RTCScene!
+//ray/hit state lives with the caller so threads can share a scene
 class RTScene {
 public:
 	RTScene();
 public:
-	int set_hdri(char * fname, int w, int h, float r);
-	int add_mesh(char * fname, vec3f * c, brdf_t b);
+	//equirectangular environment seen by rays that leave the scene;
+	//rotation turns it about +y, in radians
+	int set_hdri(char * fname, float rotation, float intensity);
+	//loads a mesh with albedo c and returns its id, or -1
+	int add_mesh(char * fname, vec3f c, const Material & m);
 public:
 	int record_obj(RTObject * obj);
+	void attach(RTObject * obj);
 	void commit();
 public:
-	void resetR();
-	void resetRH();
+	void set_quality(RTCBuildQuality scene_q, RTCBuildQuality geom_q);
+	void set_flags(RTCSceneFlags f);
+public:
+	void resetR(RTCRayHit * rh);
+	void resetRH(RTCRayHit * rh);
 	void cleanup();
+	//bytes the scene holds: Embree's allocations, textures and the
+	//mesh caches it maps
+	long memory();
 public:
 	void move(float x, float y, float z);
 	void point(float x, float y, float z);
 	void zoom(float theta);
 	void resize(int w, int h);
 public:
-	vec3f * hitP();
-	vec3f * hitN();
-public:
-	vec3f * color(int id, int prim, float u, float v);
-	float reflect(int id, int prim, float theta_i, float phi_i, float theta_o, float phi_o);
-	vec3f * emit(int id, int prim, float u, float v);
+	vec3f hitP(RTCRayHit * rh);
+	vec3f hitN(RTCRayHit * rh);
+public:
+	//width is the ray footprint at the hit in world units, for
+	//texture filtering; 0 asks for the sharpest lookup
+	vec3f color(int id, int prim, float u, float v, float width);
+	vec3f emit(int id, int prim, float u, float v, float width);
+	//radiance from the environment along dir; angle is the ray's
+	//spread in radians, for filtering
+	vec3f environment(const vec3f & dir, float angle) const;
+public:
+	//object id's material for prim: its first entry in the table, plus
+	//the prim's offset when the object has a list of them
+	//adds n entries in a row and returns the first
+	int add_materials(const Material * m, int n);
+	void set_material(int id, int first, const unsigned char * prim_offsets);
+	int material_index(int id, int prim) const {
+		const unsigned char * p = prim_materials[id];
+		return first_material[id] + (p ? p[prim] : 0);
+	}
+	Material material(int id, int prim) const {return materials.get(material_index(id, prim));}
+	bool scatters(int id, int prim) const {return materials.kind[material_index(id, prim)] != MAT_NONE;}
+public:
+	void group(RTHitBatch * b);
+	void color_batch(RTHitBatch * b, RTColorBatch * out);
+	void emit_batch(RTHitBatch * b, RTColorBatch * out);
 public:
 	RTCDevice device;
 	RTCScene scene;
-	RTCRayHit rh;
-	RTCIntersectContext context;
 	Camera * cam;
+	Texture * env;
+	float env_rotation, env_intensity;
+public:
+	//BVH build settings; objects take geom_quality when created
+	RTCBuildQuality scene_quality, geom_quality;
+	RTCSceneFlags flags;
+	//build report: time spent in commits and memory Embree holds
+	bool verbose;
+	double geom_seconds, scene_seconds;
+	long geom_bytes, scene_bytes;
+	std::atomic<long> device_bytes;
+	//entry 0 is MAT_NONE, which objects start out with
+	MaterialTable materials;
 private:
+	//objects may be recorded and attached from several loader threads
+	std::mutex lock;
 	RTObject ** obs;
-	int obj_count;
+	int obj_count, obj_cap;
+	//by object id
+	int * first_material;
+	const unsigned char ** prim_materials;
 };
 
+const char * quality_name(RTCBuildQuality q);
+
 class RTObject {
+public:
+	virtual ~RTObject() {}
+	//gives the object its id in s; false if s can't take it
+	bool record(RTScene * s);
 public:
 	RTCDevice * device;
 	RTCScene * scene;
 	RTCGeometry geom;
+	//set for prototypes, which are built into their own scene
+	RTCScene proto;
+	RTCBuildQuality quality;
+	RTScene * parent;
 	int id;
 public:
-	virtual vec3f * color(int id, float u, float v) {return new vec3f(0.f, 0.f, 0.f);}
-	virtual float reflect(int id, float theta_i, float phi_i, float theta_o, float phi_o) {return 0.f;}
-	virtual vec3f * emit(int id, float u, float v) {return new vec3f(0.f, 0.f, 0.f);}
+	virtual vec3f color(int id, float u, float v, float width) {return vec3f(0.f, 0.f, 0.f);}
+	virtual vec3f emit(int id, float u, float v, float width) {return vec3f(0.f, 0.f, 0.f);}
+public:
+	//shade the hits b[idx[0..n)], all of which belong to this object
+	virtual void color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
+	virtual void emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
 };
 
 class RTTriangleMesh : public RTObject {
 public:
-	RTTriangleMesh(RTScene * s, brdf_t m, emit_t b);
+	RTTriangleMesh(RTScene * s, const Material & m, emit_t b, bool prototype = false);
+	virtual ~RTTriangleMesh();
 public:
-	void loadFile(char * fname);
+	int loadFile(char * fname);
+	int loadCache(char * fname);
 public:
-	virtual vec3f * color(int id, float u, float v);
-	virtual float reflect(int id, float theta_i, float phi_i, float theta_o, float phi_o);
-	virtual vec3f * emit(int id, float u, float v);
+	virtual vec3f color(int id, float u, float v, float width);
+	virtual vec3f emit(int id, float u, float v, float width);
+public:
+	virtual void color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
+	virtual void emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
 public:
-	brdf_t material;
 	emit_t emission;
+	vec3f albedo;
+	//threads for parsing an OBJ; lower it when loading several at once
+	int parse_threads;
 	int num_vertices, num_triangles;
+	size_t file_size;
+	bool use_cache, cached;
+private:
+	int loadFailed();
+private:
+	MeshCache * cache;
+};
+
+//a placement of a prototype mesh; hits on it are shaded by the
+//prototype, and only the prototype's BVH is built
+class RTInstance : public RTObject {
+public:
+	RTInstance(RTScene * s, RTObject * p, const matrix3f & m, vec3f t);
+public:
+	void setTransform(const matrix3f & m, vec3f t);
+	vec3f normal(const vec3f & n) const {return normal_xfm * n;}
+public:
+	virtual vec3f color(int id, float u, float v, float width) {return prototype->color(id, u, v, width);}
+	virtual vec3f emit(int id, float u, float v, float width) {return prototype->emit(id, u, v, width);}
+public:
+	virtual void color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {prototype->color_batch(b, idx, n, out);}
+	virtual void emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {prototype->emit_batch(b, idx, n, out);}
+public:
+	RTObject * prototype;
+	matrix3f xfm;
+	vec3f offset;
+private:
+	matrix3f normal_xfm;
 };
 
 class RTSkyBox : public RTObject {
 public:
-	RTSkyBox(RTScene * s, float l, vec3f * p);
+	RTSkyBox(RTScene * s, float l, vec3f p);
+public:
+	int loadFile(char * sname, char * bname, char * tname);
+	void add_lights(RTLights * l);
 public:
-	void loadFile(char * sname, char * bname, char * tname, int w, int h);
+	virtual vec3f color(int id, float u, float v, float width);
+	virtual vec3f emit(int id, float u, float v, float width);
 public:
-	virtual vec3f * color(int id, float u, float v);
-	virtual float reflect(int id, float theta_i, float phi_i, float theta_o, float phi_o);
-	virtual vec3f * emit(int id, float u, float v);
+	virtual void color_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
+	virtual void emit_batch(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
 public:
 	float len;
-	vec3f * pos;
-private:
-	int texw, texh;
-	unsigned char *s_red, *s_green, *s_blue;
-	unsigned char *b_red, *b_green, *b_blue;
-	unsigned char *t_red, *t_green, *t_blue;
+	vec3f pos;
+public:
+	//the four sides share one strip, a quarter each
+	Texture sides, bottom, top;
 };
 
 #endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <unistd.h>
+
+#include "accum.h"
+
+Accum::Accum(int w, int h) {
+	width = w;
+	height = h;
+	seed = 0;
+	passes = 0;
+	sum_rgb = (float *)malloc(3 * (size_t)w * h * sizeof(float));
+	count = (uint32_t *)malloc((size_t)w * h * sizeof(uint32_t));
+	sum_sq = (float *)malloc((size_t)w * h * sizeof(float));
+	done = (unsigned char *)malloc((size_t)w * h);
+	clear();
+}
+
+Accum::~Accum() {
+	free(sum_rgb);
+	free(count);
+	free(sum_sq);
+	free(done);
+}
+
+void Accum::clear() {
+	memset(sum_rgb, 0, 3 * (size_t)width * height * sizeof(float));
+	memset(count, 0, (size_t)width * height * sizeof(uint32_t));
+	memset(sum_sq, 0, (size_t)width * height * sizeof(float));
+	memset(done, 0, (size_t)width * height);
+	passes = 0;
+}
+
+//relative standard error of the pixel's mean luminance
+float Accum::error(int u, int v) const {
+	int i = v * width + u;
+	float n = (float)count[i];
+	if (n < 2.f) return FLT_MAX;
+	float m = luminance(mean(u, v));
+	float var = (sum_sq[i] - n * m * m) / (n - 1.f);
+	if (var < 0.f) var = 0.f;
+	return sqrtf(var / n) / fmaxf(m, ACCUM_ERROR_FLOOR);
+}
+
+//retire pixels with at least min_spp samples whose error is under
+//threshold; returns how many are still active
+long Accum::converge(float threshold, int min_spp) {
+	long n = 0;
+	for (int v = 0; v < height; v++) {
+		for (int u = 0; u < width; u++) {
+			int i = v * width + u;
+			if (!done[i] && (int)count[i] >= min_spp && error(u, v) <= threshold) done[i] = 1;
+			if (!done[i]) n++;
+		}
+	}
+	return n;
+}
+
+//streams the means out a row at a time
+void Accum::resolve(ImageFile * out) {
+	float * row = (float *)malloc(3 * width * sizeof(float));
+	for (int v = 0; v < height; v++) {
+		for (int u = 0; u < width; u++) {
+			vec3f c = mean(u, v);
+			row[3 * u] = c.x; row[3 * u + 1] = c.y; row[3 * u + 2] = c.z;
+		}
+		out->write_rows(v, v + 1, row);
+	}
+	free(row);
+}
+
+void Accum::resolve(float * rgb) {
+	for (int v = 0; v < height; v++) {
+		for (int u = 0; u < width; u++) {
+			vec3f c = mean(u, v);
+			float * p = rgb + 3 * ((size_t)v * width + u);
+			p[0] = c.x; p[1] = c.y; p[2] = c.z;
+		}
+	}
+}
+
+void Accum::variance(float * var) {
+	for (int v = 0; v < height; v++) {
+		for (int u = 0; u < width; u++) {
+			int i = v * width + u;
+			float n = (float)count[i];
+			if (n < 2.f) {
+				var[i] = 0.f;
+				continue;
+			}
+			float m = luminance(mean(u, v));
+			float s = (sum_sq[i] - n * m * m) / (n - 1.f);
+			var[i] = s > 0.f ? s / n : 0.f;
+		}
+	}
+}
+
+//samples per pixel from blue (fewest) to red (most)
+void Accum::heat_map(ImageFile * out) {
+	uint32_t lo = UINT32_MAX, hi = 0;
+	for (int i = 0; i < width * height; i++) {
+		if (count[i] < lo) lo = count[i];
+		if (count[i] > hi) hi = count[i];
+	}
+	float scale = hi > lo ? 1.f / (float)(hi - lo) : 0.f;
+	float * row = (float *)malloc(3 * width * sizeof(float));
+	for (int v = 0; v < height; v++) {
+		for (int u = 0; u < width; u++) {
+			float t = (float)(count[v * width + u] - lo) * scale;
+			row[3 * u] = t; row[3 * u + 1] = 4.f * t * (1.f - t); row[3 * u + 2] = 1.f - t;
+		}
+		out->write_rows(v, v + 1, row);
+	}
+	free(row);
+}
+
+long Accum::total_samples() const {
+	long n = 0;
+	for (int i = 0; i < width * height; i++) n += count[i];
+	return n;
+}
+
+long Accum::max_samples() const {
+	uint32_t n = 0;
+	for (int i = 0; i < width * height; i++) if (count[i] > n) n = count[i];
+	return n;
+}
+
+bool Accum::block_empty(int bx, int by) const {
+	int x1 = (bx + 1) * ACCUM_BLOCK < width ? (bx + 1) * ACCUM_BLOCK : width;
+	int y1 = (by + 1) * ACCUM_BLOCK < height ? (by + 1) * ACCUM_BLOCK : height;
+	for (int v = by * ACCUM_BLOCK; v < y1; v++) {
+		for (int u = bx * ACCUM_BLOCK; u < x1; u++) {
+			if (count[v * width + u]) return false;
+		}
+	}
+	return true;
+}
+
+//reads or writes one block's rows of sums, counts and squares
+bool Accum::block_io(FILE * f, int bx, int by, bool write) {
+	int x0 = bx * ACCUM_BLOCK, y0 = by * ACCUM_BLOCK;
+	int y1 = y0 + ACCUM_BLOCK < height ? y0 + ACCUM_BLOCK : height;
+	size_t w = x0 + ACCUM_BLOCK < width ? ACCUM_BLOCK : width - x0;
+	bool ok = true;
+	for (int v = y0; v < y1 && ok; v++) {
+		float * p = &sum_rgb[3 * ((size_t)v * width + x0)];
+		ok = (write ? fwrite(p, 3 * sizeof(float), w, f) : fread(p, 3 * sizeof(float), w, f)) == w;
+	}
+	for (int v = y0; v < y1 && ok; v++) {
+		uint32_t * p = &count[(size_t)v * width + x0];
+		ok = (write ? fwrite(p, sizeof(uint32_t), w, f) : fread(p, sizeof(uint32_t), w, f)) == w;
+	}
+	for (int v = y0; v < y1 && ok; v++) {
+		float * p = &sum_sq[(size_t)v * width + x0];
+		ok = (write ? fwrite(p, sizeof(float), w, f) : fread(p, sizeof(float), w, f)) == w;
+	}
+	return ok;
+}
+
+//write to a temporary and rename, so a pre-empted job never leaves
+//a torn checkpoint behind
+int Accum::save(char * fname) {
+	int bw = (width + ACCUM_BLOCK - 1) / ACCUM_BLOCK, bh = (height + ACCUM_BLOCK - 1) / ACCUM_BLOCK;
+	AccumHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ACCUM_MAGIC, 4);
+	h.version = ACCUM_VERSION;
+	h.width = width; h.height = height;
+	h.seed = seed;
+	h.passes = passes;
+	h.block = ACCUM_BLOCK;
+	for (int by = 0; by < bh; by++) {
+		for (int bx = 0; bx < bw; bx++) {
+			if (!block_empty(bx, by)) h.n_blocks++;
+		}
+	}
+
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.%d", fname, (int)getpid());
+	FILE * f = fopen(tmp, "wb");
+	if (!f) return -1;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	for (int by = 0; by < bh && ok; by++) {
+		for (int bx = 0; bx < bw && ok; bx++) {
+			if (block_empty(bx, by)) continue;
+			uint32_t at[2] = {(uint32_t)bx, (uint32_t)by};
+			ok = fwrite(at, sizeof(at), 1, f) == 1 && block_io(f, bx, by, true);
+		}
+	}
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp, fname) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int Accum::load(char * fname) {
+	FILE * f = fopen(fname, "rb");
+	if (!f) return -1;
+	AccumHeader h;
+	if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, ACCUM_MAGIC, 4) != 0 || h.version != ACCUM_VERSION
+			|| (int)h.width != width || (int)h.height != height || h.block != ACCUM_BLOCK) {
+		printf("%s is not a %dx%d checkpoint\n", fname, width, height);
+		fclose(f);
+		return -1;
+	}
+	clear();
+	int bw = (width + ACCUM_BLOCK - 1) / ACCUM_BLOCK, bh = (height + ACCUM_BLOCK - 1) / ACCUM_BLOCK;
+	bool ok = true;
+	for (uint32_t i = 0; i < h.n_blocks && ok; i++) {
+		uint32_t at[2];
+		ok = fread(at, sizeof(at), 1, f) == 1 && (int)at[0] < bw && (int)at[1] < bh && block_io(f, at[0], at[1], false);
+	}
+	fclose(f);
+	if (!ok) {
+		printf("%s is truncated\n", fname);
+		clear();
+		return -1;
+	}
+	seed = h.seed;
+	passes = h.passes;
+	return 0;
+}
+
+//adds another buffer of the same size, as rendered by a job that had
+//other tiles or other samples of the same pixels
+int Accum::merge(char * fname) {
+	Accum part(width, height);
+	if (part.load(fname) < 0) return -1;
+	//-O splits one sample sequence between jobs, and the sequence
+	//depends on the seed, so jobs with other seeds can't be merged
+	if (part.seed != seed) {
+		printf("%s was rendered with seed %u, not %u\n", fname, part.seed, seed);
+		return -1;
+	}
+	size_t n = (size_t)width * height;
+	for (size_t i = 0; i < n; i++) {
+		sum_rgb[3 * i] += part.sum_rgb[3 * i];
+		sum_rgb[3 * i + 1] += part.sum_rgb[3 * i + 1];
+		sum_rgb[3 * i + 2] += part.sum_rgb[3 * i + 2];
+		count[i] += part.count[i];
+		sum_sq[i] += part.sum_sq[i];
+	}
+	if (part.passes > passes) passes = part.passes;
+	return 0;
+}
+
+int accum_header(char * fname, AccumHeader * h) {
+	FILE * f = fopen(fname, "rb");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+	bool ok = fread(h, sizeof(*h), 1, f) == 1 && memcmp(h->magic, ACCUM_MAGIC, 4) == 0 && h->version == ACCUM_VERSION;
+	fclose(f);
+	if (!ok) {
+		printf("%s is not a sample buffer\n", fname);
+		return -1;
+	}
+	return 0;
+}
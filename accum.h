@@ -0,0 +1,86 @@
+#ifndef __ACCUM_H
+#define __ACCUM_H
+
+#include <stdint.h>
+
+#include "geom.h"
+#include "image.h"
+
+#define ACCUM_MAGIC "RTAC"
+#define ACCUM_VERSION 3
+
+//pixels per side of the blocks a buffer is stored in
+#define ACCUM_BLOCK 16
+
+//relative error is measured against at least this mean, so near-black
+//pixels don't chase tiny absolute noise
+#define ACCUM_ERROR_FLOOR 0.05f
+
+//on-disk header of a checkpoint; followed by the blocks that have any
+//samples, each its uint32 column and row in blocks, then its float
+//sums (3 per pixel), uint32 sample counts and float luminance squares,
+//all row-major within the block. blocks left out have no samples, so
+//a job that rendered a few tiles writes just those
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t seed;
+	uint32_t passes;
+	uint32_t block, n_blocks;
+} AccumHeader;
+
+//running per-pixel sums of radiance samples, kept apart from the
+//8-bit output so passes can be added, saved and resumed
+class Accum {
+public:
+	Accum(int w, int h);
+	~Accum();
+public:
+	//sq is the sum of the squared luminance of each of the n samples
+	void add(int u, int v, const vec3f & sum, int n, float sq) {
+		float * p = &sum_rgb[3 * (v * width + u)];
+		p[0] += sum.x; p[1] += sum.y; p[2] += sum.z;
+		count[v * width + u] += n;
+		sum_sq[v * width + u] += sq;
+	}
+	vec3f mean(int u, int v) const {
+		int i = v * width + u;
+		if (count[i] == 0) return vec3f(0.f, 0.f, 0.f);
+		float c = 1.f / (float)count[i];
+		return vec3f(sum_rgb[3 * i] * c, sum_rgb[3 * i + 1] * c, sum_rgb[3 * i + 2] * c);
+	}
+	float error(int u, int v) const;
+	bool active(int u, int v) const {return !done[v * width + u];}
+	long converge(float threshold, int min_spp);
+	void clear();
+	void resolve(ImageFile * out);
+	//means into a row-major RGB buffer
+	void resolve(float * rgb);
+	//variance of each pixel's mean luminance, 0 under two samples
+	void variance(float * var);
+	void heat_map(ImageFile * out);
+	long total_samples() const;
+	long max_samples() const;
+public:
+	int save(char * fname);
+	int load(char * fname);
+	int merge(char * fname);
+private:
+	bool block_empty(int bx, int by) const;
+	bool block_io(FILE * f, int bx, int by, bool write);
+public:
+	int width, height;
+	unsigned int seed;
+	int passes;
+	float * sum_rgb;
+	uint32_t * count;
+	float * sum_sq;
+	//pixels that need no more samples
+	unsigned char * done;
+};
+
+//reads just the header, to size a buffer before loading it
+int accum_header(char * fname, AccumHeader * h);
+
+#endif
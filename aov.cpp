@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aov.h"
+#include "image.h"
+
+AOV::AOV(int w, int h) {
+	width = w;
+	height = h;
+	size_t n = (size_t)w * h;
+	albedo = (float *)calloc(3 * n, sizeof(float));
+	normal = (float *)calloc(3 * n, sizeof(float));
+	depth = (float *)calloc(n, sizeof(float));
+	id = (int32_t *)malloc(n * sizeof(int32_t));
+	for (size_t i = 0; i < n; i++) id[i] = -1;
+}
+
+AOV::~AOV() {
+	free(albedo);
+	free(normal);
+	free(depth);
+	free(id);
+}
+
+//one channel planes are written as grey
+static int write_plane(char * prefix, const char * name, const float * rgb, const float * grey, const int32_t * ids, int w, int h) {
+	char fname[4096];
+	snprintf(fname, sizeof(fname), "%s.%s.pfm", prefix, name);
+	ImageFile out;
+	if (out.open(fname, w, h, 0) < 0) return -1;
+	if (rgb) {
+		out.write_rows(0, h, rgb);
+		return out.close();
+	}
+	float * row = (float *)malloc(3 * w * sizeof(float));
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			size_t i = (size_t)y * w + x;
+			float g = grey ? grey[i] : (float)ids[i];
+			row[3 * x] = g; row[3 * x + 1] = g; row[3 * x + 2] = g;
+		}
+		out.write_rows(y, y + 1, row);
+	}
+	free(row);
+	return out.close();
+}
+
+int AOV::write(char * prefix) {
+	if (write_plane(prefix, "albedo", albedo, NULL, NULL, width, height) < 0) return -1;
+	if (write_plane(prefix, "normal", normal, NULL, NULL, width, height) < 0) return -1;
+	if (write_plane(prefix, "depth", NULL, depth, NULL, width, height) < 0) return -1;
+	return write_plane(prefix, "id", NULL, NULL, id, width, height);
+}
@@ -0,0 +1,34 @@
+#ifndef __AOV_H
+#define __AOV_H
+
+#include <stdint.h>
+
+#include "geom.h"
+
+//noise-free per-pixel data from the camera hit (AOVs), for guiding
+//the denoiser and for compositing. all planes are row-major
+class AOV {
+public:
+	AOV(int w, int h);
+	~AOV();
+public:
+	//a miss has no surface: albedo is what the camera sees, normal and
+	//depth are 0 and id is -1
+	void set(int u, int v, const vec3f & albedo, const vec3f & normal, float depth, int id) {
+		size_t i = (size_t)v * width + u;
+		this->albedo[3 * i] = albedo.x; this->albedo[3 * i + 1] = albedo.y; this->albedo[3 * i + 2] = albedo.z;
+		this->normal[3 * i] = normal.x; this->normal[3 * i + 1] = normal.y; this->normal[3 * i + 2] = normal.z;
+		this->depth[i] = depth;
+		this->id[i] = id;
+	}
+	//prefix.albedo.pfm, .normal.pfm, .depth.pfm and .id.pfm
+	int write(char * prefix);
+public:
+	int width, height;
+	float * albedo;
+	float * normal;
+	float * depth;
+	int32_t * id;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include <stdlib.h>
+
+#include "batch.h"
+
+void alloc_batch(RTHitBatch * b, int cap) {
+	b->n = 0; b->cap = cap;
+	b->geomID = (unsigned int *)malloc(cap * sizeof(unsigned int));
+	b->primID = (unsigned int *)malloc(cap * sizeof(unsigned int));
+	b->u = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	b->v = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	b->dx = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	b->dy = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	b->dz = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	b->width = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	b->order = (int *)malloc(cap * sizeof(int));
+	b->runs = (int *)malloc((cap + 1) * sizeof(int));
+	b->n_runs = 0;
+	b->counts = NULL;
+	b->n_counts = 0;
+}
+
+void free_batch(RTHitBatch * b) {
+	free(b->geomID); free(b->primID);
+	free(b->u); free(b->v);
+	free(b->dx); free(b->dy); free(b->dz);
+	free(b->width);
+	free(b->order); free(b->runs);
+	free(b->counts);
+}
+
+void alloc_colors(RTColorBatch * c, int cap) {
+	c->r = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	c->g = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+	c->b = (float *)aligned_alloc(32, ((cap + 7) & ~7) * sizeof(float));
+}
+
+void free_colors(RTColorBatch * c) {
+	free(c->r); free(c->g); free(c->b);
+}
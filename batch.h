@@ -0,0 +1,51 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <embree3/rtcore.h>
+
+//a batch of hits to shade, stored as parallel arrays
+//RTScene::group sorts it by object so each object shades its
+//hits in one call instead of one virtual call per hit
+typedef struct {
+	int n, cap;
+	unsigned int *geomID, *primID;
+	float *u, *v;
+	float *dx, *dy, *dz;
+	//ray footprint at the hit, see RTScene::color
+	float *width;
+	//filled by RTScene::group: hit indices ordered by object, and the
+	//start of each run of equal objects in that order
+	int *order, *runs;
+	int n_runs;
+	int *counts;
+	int n_counts;
+} RTHitBatch;
+
+//caller-owned colour output, indexed like the hits
+typedef struct {
+	float *r, *g, *b;
+} RTColorBatch;
+
+void alloc_batch(RTHitBatch * b, int cap);
+void free_batch(RTHitBatch * b);
+void alloc_colors(RTColorBatch * c, int cap);
+void free_colors(RTColorBatch * c);
+
+//the object to shade a hit with: instanced hits are shaded through
+//their instance, which knows the prototype
+inline unsigned int hit_id(const RTCHit & h) {
+	return h.instID[0] != RTC_INVALID_GEOMETRY_ID ? h.instID[0] : h.geomID;
+}
+
+//append a traced ray; returns its index in the batch
+//geomID holds the hit_id, so it indexes the scene's objects
+inline int add_hit(RTHitBatch * b, RTCRayHit * rh, float width) {
+	int i = b->n++;
+	b->width[i] = width;
+	b->geomID[i] = hit_id(rh->hit); b->primID[i] = rh->hit.primID;
+	b->u[i] = rh->hit.u; b->v[i] = rh->hit.v;
+	b->dx[i] = rh->ray.dir_x; b->dy[i] = rh->ray.dir_y; b->dz[i] = rh->ray.dir_z;
+	return i;
+}
+
+#endif
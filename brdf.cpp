@@ -1,11 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "brdf.h"
 
-float brdf_lambert(float theta_i, float phi_i, float theta_o, float phi_o) {
-	return 1.f;
+//below this GGX is a mirror the sampler can't tell from a delta
+#define GGX_MIN_ALPHA 1e-3f
+
+void material_init(Material * m) {
+	m->kind = MAT_LAMBERT;
+	m->roughness = 0.f;
+	m->ior = 1.5f;
+}
+
+int parse_material(const char * name, const char * param, Material * m) {
+	material_init(m);
+	if (!strcmp(name, "lambert")) return 0;
+	if (!param) return -1;
+	char * end;
+	float x = strtof(param, &end);
+	if (*end) return -1;
+	if (!strcmp(name, "ggx") && x >= 0.f && x <= 1.f) {
+		m->kind = MAT_GGX;
+		m->roughness = fmaxf(x, GGX_MIN_ALPHA);
+		return 0;
+	}
+	if (!strcmp(name, "glass") && x > 0.f) {
+		m->kind = MAT_DIELECTRIC;
+		m->ior = x;
+		return 0;
+	}
+	return -1;
+}
+
+//GGX normal distribution, for a half vector at cos c to the normal
+inline float ggx_d(float a, float c) {
+	float a2 = a * a;
+	float t = c * c * (a2 - 1.f) + 1.f;
+	return a2 / ((float)M_PI * t * t);
+}
+
+//Smith masking of one direction at cos c
+inline float ggx_g1(float a, float c) {
+	float a2 = a * a;
+	return 2.f * c / (c + sqrtf(a2 + (1.f - a2) * c * c));
+}
+
+//fraction reflected at a smooth interface, for light arriving at cos
+//c on the side with index 1 and eta beyond; 1 past the critical angle
+inline float fresnel(float c, float eta, float * cos_t) {
+	float s2 = (1.f - c * c) / (eta * eta);
+	if (s2 >= 1.f) {
+		*cos_t = 0.f;
+		return 1.f;
+	}
+	float ct = sqrtf(1.f - s2);
+	float rs = (c - eta * ct) / (c + eta * ct);
+	float rp = (eta * c - ct) / (eta * c + ct);
+	*cos_t = ct;
+	return 0.5f * (rs * rs + rp * rp);
+}
+
+float bsdf_eval(const Material * m, const vec3f & wo, const vec3f & wi) {
+	if (wo.z <= 0.f || wi.z <= 0.f) return 0.f;
+	if (m->kind == MAT_LAMBERT) return 1.f / (float)M_PI;
+	if (m->kind != MAT_GGX) return 0.f;
+	vec3f h = (wo + wi).normalized();
+	float a = m->roughness;
+	return ggx_d(a, h.z) * ggx_g1(a, wo.z) * ggx_g1(a, wi.z) / (4.f * wo.z * wi.z);
+}
+
+float bsdf_pdf(const Material * m, const vec3f & wo, const vec3f & wi) {
+	if (wo.z <= 0.f || wi.z <= 0.f) return 0.f;
+	if (m->kind == MAT_LAMBERT) return wi.z / (float)M_PI;
+	if (m->kind != MAT_GGX) return 0.f;
+	//visible normals: D G1(wo) (wo.h) / wo.z, times the reflection's
+	//jacobian 1 / (4 wo.h)
+	vec3f h = (wo + wi).normalized();
+	float a = m->roughness;
+	return ggx_d(a, h.z) * ggx_g1(a, wo.z) / (4.f * wo.z);
+}
+
+//a normal from the GGX distribution of those wo sees (Heitz 2018)
+static vec3f ggx_visible_normal(float a, const vec3f & wo, float u1, float u2) {
+	vec3f vh = vec3f(a * wo.x, a * wo.y, wo.z).normalized();
+	float len2 = vh.x * vh.x + vh.y * vh.y;
+	vec3f t1 = len2 > 0.f ? vec3f(-vh.y, vh.x, 0.f) * (1.f / sqrtf(len2)) : vec3f(1.f, 0.f, 0.f);
+	vec3f t2 = vh.cross(t1);
+	float r = sqrtf(u1), phi = 2.f * (float)M_PI * u2;
+	float p1 = r * cosf(phi), p2 = r * sinf(phi);
+	float s = 0.5f * (1.f + vh.z);
+	p2 = (1.f - s) * sqrtf(fmaxf(0.f, 1.f - p1 * p1)) + s * p2;
+	vec3f nh = t1 * p1 + t2 * p2 + vh * sqrtf(fmaxf(0.f, 1.f - p1 * p1 - p2 * p2));
+	return vec3f(a * nh.x, a * nh.y, fmaxf(1e-6f, nh.z)).normalized();
+}
+
+bool bsdf_sample(const Material * m, const vec3f & wo, float u1, float u2, float u3, vec3f * wi, float * w, float * pdf) {
+	if (m->kind == MAT_LAMBERT) {
+		float r = sqrtf(u1), phi = 2.f * (float)M_PI * u2;
+		*wi = vec3f(r * cosf(phi), r * sinf(phi), sqrtf(fmaxf(0.f, 1.f - u1)));
+		*w = 1.f;
+		*pdf = wi->z / (float)M_PI;
+		return true;
+	}
+	if (m->kind == MAT_GGX) {
+		if (wo.z <= 0.f) return false;
+		float a = m->roughness;
+		vec3f h = ggx_visible_normal(a, wo, u1, u2);
+		float oh = wo.dot(h);
+		*wi = h * (2.f * oh) - wo;
+		if (wi->z <= 0.f) return false;
+		//f cos / pdf leaves the masking of wi
+		*w = ggx_g1(a, wi->z);
+		*pdf = ggx_d(a, h.z) * ggx_g1(a, wo.z) / (4.f * wo.z);
+		return true;
+	}
+	if (m->kind == MAT_DIELECTRIC) {
+		//picking the lobe by its Fresnel weight cancels that weight
+		float ct;
+		float c = fabsf(wo.z);
+		float f = fresnel(c, m->ior, &ct);
+		*w = 1.f;
+		*pdf = 0.f;
+		if (u3 < f) *wi = vec3f(-wo.x, -wo.y, wo.z);
+		else *wi = vec3f(-wo.x / m->ior, -wo.y / m->ior, -ct);
+		return true;
+	}
+	return false;
+}
+
+MaterialTable::MaterialTable() {
+	n = 0;
+	cap = 0;
+	kind = NULL;
+	roughness = NULL;
+	ior = NULL;
+}
+
+MaterialTable::~MaterialTable() {
+	free(kind);
+	free(roughness);
+	free(ior);
+}
+
+int MaterialTable::add(const Material & m) {
+	if (n == cap) {
+		cap = cap ? 2 * cap : 16;
+		kind = (int *)realloc(kind, cap * sizeof(int));
+		roughness = (float *)realloc(roughness, cap * sizeof(float));
+		ior = (float *)realloc(ior, cap * sizeof(float));
+	}
+	kind[n] = m.kind;
+	roughness[n] = m.roughness;
+	ior[n] = m.ior;
+	return n++;
 }
 
-vec3f * emit_black(int id, float u, float v) {
-	return new vec3f(0.f, 0.f, 0.f);
+void emit_black(RTHitBatch * b, int * idx, int n, RTColorBatch * out) {
+	for (int k = 0; k < n; k++) {
+		int i = idx[k];
+		out->r[i] = 0.f; out->g[i] = 0.f; out->b[i] = 0.f;
+	}
 }
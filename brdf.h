@@ -2,14 +2,63 @@
 #define __BRDF_H
 
 #include "geom.h"
+#include "batch.h"
 
-typedef float (*brdf_t)(float, float, float, float);
-typedef vec3f* (*emit_t)(int, float, float);
+//emission is evaluated for a whole run of hits at once
+typedef void (*emit_t)(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
 
-//uniform BRDF
-float brdf_lambert(float theta_i, float phi_i, float theta_o, float phi_o);
+enum {
+	MAT_NONE,       //doesn't scatter; the sky's faces only emit
+	MAT_LAMBERT,
+	MAT_GGX,        //rough mirror on GGX microfacets, the albedo its reflectance
+	MAT_DIELECTRIC, //smooth glass: reflects or refracts by Fresnel
+};
+
+//how a surface scatters; the albedo from color() tints all of it
+typedef struct {
+	int kind;
+	float roughness; //GGX alpha
+	float ior;       //dielectric: the far side's index over the near side's
+} Material;
+
+//lambert
+void material_init(Material * m);
+//as a scene file names it: lambert, ggx ROUGHNESS or glass IOR
+int parse_material(const char * name, const char * param, Material * m);
+inline bool material_delta(const Material * m) {return m->kind == MAT_DIELECTRIC;}
+
+//directions are in the shading frame, whose +z is the normal on the
+//side wo is on. wo points back where the path came from and wi the way
+//it goes on; values are per unit albedo
+
+//brdf value without the cosine; 0 for delta lobes
+float bsdf_eval(const Material * m, const vec3f & wo, const vec3f & wi);
+//solid angle pdf of bsdf_sample picking wi; 0 for delta lobes
+float bsdf_pdf(const Material * m, const vec3f & wo, const vec3f & wi);
+//picks wi from (u1, u2), and a lobe from u3. *w is f cos / pdf and *pdf
+//is 0 for a delta lobe; false if the path is absorbed
+bool bsdf_sample(const Material * m, const vec3f & wo, float u1, float u2, float u3, vec3f * wi, float * w, float * pdf);
+
+//every material of a scene as parallel arrays, so a lookup reads
+//only the fields it needs
+class MaterialTable {
+public:
+	MaterialTable();
+	~MaterialTable();
+public:
+	int add(const Material & m);
+	Material get(int i) const {
+		Material m = {kind[i], roughness[i], ior[i]};
+		return m;
+	}
+public:
+	int n, cap;
+	int * kind;
+	float * roughness;
+	float * ior;
+};
 
 //no emission
-vec3f * emit_black(int id, float u, float v);
+void emit_black(RTHitBatch * b, int * idx, int n, RTColorBatch * out);
 
 #endif
@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+
+#include "denoise.h"
+
+//albedo below this is taken as this when dividing it out
+#define DENOISE_ALBEDO_FLOOR 1e-3f
+#define DENOISE_EPS 1e-4f
+
+//B3 spline, the a-trous kernel
+static const float kernel[5] = {1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+
+void denoise_init(DenoiseParams * p) {
+	p->iterations = 5;
+	p->sigma_color = 4.f;
+	p->sigma_normal = 0.02f;
+	p->sigma_depth = 0.05f;
+	p->sigma_albedo = 0.1f;
+}
+
+//lighting and its variance, one plane each
+typedef struct {
+	float * r, * g, * b, * var;
+} Layer;
+
+//the features as planes, so the filter reads them with unit stride
+typedef struct {
+	float * nx, * ny, * nz, * z;
+	float * ar, * ag, * ab;
+	int32_t * id;
+} Guide;
+
+//a row of the layer and the guide from some pixel on
+typedef struct {
+	const float * r, * g, * b, * var;
+	const float * nx, * ny, * nz, * z;
+	const float * ar, * ag, * ab;
+	const int32_t * id;
+} Row;
+
+//per row sums over the taps
+typedef struct {
+	float * w, * r, * g, * b, * var;
+} Sums;
+
+static Row row_at(const Layer * l, const Guide * g, size_t i) {
+	Row r = {l->r + i, l->g + i, l->b + i, l->var + i, g->nx + i, g->ny + i, g->nz + i, g->z + i,
+		g->ar + i, g->ag + i, g->ab + i, g->id + i};
+	return r;
+}
+
+//e^-x for x >= 0 without a branch or a call, so the loop below
+//vectorises: 2^i from the exponent bits times a polynomial for 2^f
+inline float exp_neg(float x) {
+	float t = x * -1.44269504f;
+	t = t < -126.f ? -126.f : t;
+	float u = t + 127.f;
+	int i = (int)u;
+	float f = u - (float)i;
+	float p = 1.f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f + f * 0.00961812911f)));
+	uint32_t bits = (uint32_t)i << 23;
+	float s;
+	memcpy(&s, &bits, sizeof(s));
+	return s * p;
+}
+
+//adds one tap of the kernel to n pixels of a row. p is the row being
+//filtered, q the same pixels shifted by the tap. lp, sd and zp hold
+//the luminance, 1 / noise and 1 / depth of the row's pixels
+static void tap(int n, float hk, float kz, const DenoiseParams * dp, const Row & p, const Row & q,
+		const float * __restrict lp, const float * __restrict sd, const float * __restrict zp, const Sums & s) {
+	const float * __restrict pnx = p.nx, * __restrict pny = p.ny, * __restrict pnz = p.nz, * __restrict pz = p.z;
+	const float * __restrict par = p.ar, * __restrict pag = p.ag, * __restrict pab = p.ab;
+	const int32_t * __restrict pid = p.id;
+	const float * __restrict qr = q.r, * __restrict qg = q.g, * __restrict qb = q.b, * __restrict qv = q.var;
+	const float * __restrict qnx = q.nx, * __restrict qny = q.ny, * __restrict qnz = q.nz, * __restrict qz = q.z;
+	const float * __restrict qar = q.ar, * __restrict qag = q.ag, * __restrict qab = q.ab;
+	const int32_t * __restrict qid = q.id;
+	float * __restrict sw = s.w, * __restrict sr = s.r, * __restrict sg = s.g, * __restrict sb = s.b, * __restrict sv = s.var;
+	float kn = 1.f / dp->sigma_normal, ka = 1.f / dp->sigma_albedo;
+	for (int x = 0; x < n; x++) {
+		float lq = 0.2126f * qr[x] + 0.7152f * qg[x] + 0.0722f * qb[x];
+		float e = fabsf(lq - lp[x]) * sd[x];
+		e += (1.f - (pnx[x] * qnx[x] + pny[x] * qny[x] + pnz[x] * qnz[x])) * kn;
+		e += fabsf(qz[x] - pz[x]) * zp[x] * kz;
+		e += (fabsf(qar[x] - par[x]) + fabsf(qag[x] - pag[x]) + fabsf(qab[x] - pab[x])) * ka;
+		float w = hk * exp_neg(e);
+		w = pid[x] == qid[x] ? w : 0.f;
+		sw[x] += w;
+		sr[x] += w * qr[x]; sg[x] += w * qg[x]; sb[x] += w * qb[x];
+		sv[x] += w * w * qv[x];
+	}
+}
+
+//one a-trous pass over rows y0 .. y1 - 1
+static void filter_band(const DenoiseParams * dp, const Guide * g, const Layer * src, Layer * dst,
+		int w, int h, int step, int y0, int y1) {
+	float * scratch = (float *)malloc(8 * w * sizeof(float));
+	float * lp = scratch, * sd = scratch + w, * zp = scratch + 2 * w;
+	Sums s = {scratch + 3 * w, scratch + 4 * w, scratch + 5 * w, scratch + 6 * w, scratch + 7 * w};
+
+	for (int y = y0; y < y1; y++) {
+		size_t row = (size_t)y * w;
+		for (int x = 0; x < w; x++) {
+			size_t i = row + x;
+			lp[x] = 0.2126f * src->r[i] + 0.7152f * src->g[i] + 0.0722f * src->b[i];
+			sd[x] = 1.f / (dp->sigma_color * sqrtf(src->var[i]) + DENOISE_EPS);
+			zp[x] = 1.f / (dp->sigma_depth * g->z[i] + DENOISE_EPS);
+		}
+		memset(s.w, 0, 5 * w * sizeof(float));
+
+		for (int dy = -2; dy <= 2; dy++) {
+			int yq = y + dy * step;
+			if (yq < 0 || yq >= h) continue;
+			for (int dx = -2; dx <= 2; dx++) {
+				//only the pixels whose tap lands inside the image
+				int off = dx * step;
+				int x0 = off < 0 ? -off : 0, x1 = off > 0 ? w - off : w;
+				if (x0 >= x1) continue;
+				int ady = dy < 0 ? -dy : dy, adx = dx < 0 ? -dx : dx;
+				float kz = 1.f / (float)(step * (adx > ady ? adx : ady));
+				kz = adx == 0 && ady == 0 ? 0.f : kz;
+				Row p = row_at(src, g, row + x0);
+				Row q = row_at(src, g, (size_t)yq * w + x0 + off);
+				Sums t = {s.w + x0, s.r + x0, s.g + x0, s.b + x0, s.var + x0};
+				tap(x1 - x0, kernel[dy + 2] * kernel[dx + 2], kz, dp, p, q, lp + x0, sd + x0, zp + x0, t);
+			}
+		}
+
+		//the centre tap always has weight, so the sums are never 0
+		for (int x = 0; x < w; x++) {
+			size_t i = row + x;
+			float k = 1.f / s.w[x];
+			dst->r[i] = s.r[x] * k; dst->g[i] = s.g[x] * k; dst->b[i] = s.b[x] * k;
+			dst->var[i] = s.var[x] * k * k;
+		}
+	}
+	free(scratch);
+}
+
+static Layer alloc_layer(size_t n) {
+	float * m = (float *)malloc(4 * n * sizeof(float));
+	Layer l = {m, m + n, m + 2 * n, m + 3 * n};
+	return l;
+}
+
+void denoise(const DenoiseParams * p, const AOV * f, const float * var, float * rgb, int n_threads) {
+	int w = f->width, h = f->height;
+	size_t n = (size_t)w * h;
+	if (n_threads < 1) n_threads = 1;
+
+	//features to planes, albedo floored so it can be divided out
+	float * gm = (float *)malloc(7 * n * sizeof(float));
+	Guide g = {gm, gm + n, gm + 2 * n, gm + 3 * n, gm + 4 * n, gm + 5 * n, gm + 6 * n, f->id};
+	Layer a = alloc_layer(n), b = alloc_layer(n);
+	for (size_t i = 0; i < n; i++) {
+		g.nx[i] = f->normal[3 * i]; g.ny[i] = f->normal[3 * i + 1]; g.nz[i] = f->normal[3 * i + 2];
+		g.z[i] = f->depth[i];
+		g.ar[i] = fmaxf(f->albedo[3 * i], DENOISE_ALBEDO_FLOOR);
+		g.ag[i] = fmaxf(f->albedo[3 * i + 1], DENOISE_ALBEDO_FLOOR);
+		g.ab[i] = fmaxf(f->albedo[3 * i + 2], DENOISE_ALBEDO_FLOOR);
+		a.r[i] = rgb[3 * i] / g.ar[i]; a.g[i] = rgb[3 * i + 1] / g.ag[i]; a.b[i] = rgb[3 * i + 2] / g.ab[i];
+		float y = 0.2126f * g.ar[i] + 0.7152f * g.ag[i] + 0.0722f * g.ab[i];
+		b.var[i] = var[i] / (y * y);
+	}
+
+	//a single pixel's variance is itself noisy at low sample counts,
+	//so start from a 3x3 average
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			float s = 0.f;
+			int c = 0;
+			for (int j = y - 1; j <= y + 1; j++) {
+				for (int i = x - 1; i <= x + 1; i++) {
+					if (i < 0 || j < 0 || i >= w || j >= h) continue;
+					s += b.var[(size_t)j * w + i];
+					c++;
+				}
+			}
+			a.var[(size_t)y * w + x] = s / (float)c;
+		}
+	}
+
+	std::thread * pool = new std::thread[n_threads];
+	for (int it = 0; it < p->iterations; it++) {
+		for (int i = 0; i < n_threads; i++) {
+			int y0 = (int)((long)h * i / n_threads), y1 = (int)((long)h * (i + 1) / n_threads);
+			pool[i] = std::thread(filter_band, p, &g, &a, &b, w, h, 1 << it, y0, y1);
+		}
+		for (int i = 0; i < n_threads; i++) {
+			pool[i].join();
+		}
+		Layer t = a; a = b; b = t;
+	}
+	delete[] pool;
+
+	for (size_t i = 0; i < n; i++) {
+		rgb[3 * i] = a.r[i] * g.ar[i]; rgb[3 * i + 1] = a.g[i] * g.ag[i]; rgb[3 * i + 2] = a.b[i] * g.ab[i];
+	}
+	free(a.r);
+	free(b.r);
+	free(gm);
+}
@@ -0,0 +1,24 @@
+#ifndef __DENOISE_H
+#define __DENOISE_H
+
+#include "aov.h"
+
+//edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided
+//by the camera hit features and the per-pixel sample variance, in the
+//manner of SVGF (Schied et al. 2017) without the temporal part
+typedef struct {
+	int iterations;     //5x5 passes with steps 1, 2, 4, ...
+	float sigma_color;  //in standard deviations of the pixel's noise
+	float sigma_normal; //1 - cos of the angle between normals
+	float sigma_depth;  //relative depth change per pixel of distance
+	float sigma_albedo; //summed over the channels
+} DenoiseParams;
+
+void denoise_init(DenoiseParams * p);
+
+//filters row-major RGB w*h in place. var is the variance of each
+//pixel's mean luminance (see Accum::variance). lighting is filtered
+//with the albedo divided out, so texture detail stays sharp
+void denoise(const DenoiseParams * p, const AOV * f, const float * var, float * rgb, int n_threads);
+
+#endif
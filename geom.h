@@ -8,61 +8,147 @@ class matrix3f;
 class vec3f;
 class Camera;
 
-class matrix3f {
+//plain value type; the 16 byte alignment lets the compiler use
+//one SSE register per vector
+class alignas(16) vec3f {
 public:
-	matrix3f(float a11, float a12, float a13,
-					 float a21, float a22, float a23,
-					 float a31, float a32, float a33);
-	matrix3f() {}
+	vec3f() {}
+	vec3f(float u, float v, float w) {x = u; y = v; z = w;}
 public:
-	vec3f * mul(vec3f * x);
-	matrix3f * mul(float c);
-	float at(int i, int j);
-	void set(int i, int j, float x);
-private:
-	float data[3][3];
+	float abs() const {return sqrtf(x * x + y * y + z * z);}
+	vec3f cross(const vec3f & b) const {return vec3f(y * b.z - z * b.y, z * b.x - x * b.z, x * b.y - y * b.x);}
+	float dot(const vec3f & b) const {return x * b.x + y * b.y + z * b.z;}
+public:
+	void normalize() { //modifies this vector!
+		float a = abs();
+		if (a == 0.f) return;
+		x /= a; y /= a; z /= a;
+	}
+	vec3f normalized() const {vec3f r = *this; r.normalize(); return r;}
+public:
+	vec3f & operator+=(const vec3f & b) {x += b.x; y += b.y; z += b.z; return *this;}
+	vec3f & operator-=(const vec3f & b) {x -= b.x; y -= b.y; z -= b.z; return *this;}
+	vec3f & operator*=(const vec3f & b) {x *= b.x; y *= b.y; z *= b.z; return *this;}
+	vec3f & operator*=(float c) {x *= c; y *= c; z *= c; return *this;}
+public:
+	float x; float y; float z;
 };
 
-class vec3f {
+inline vec3f operator+(const vec3f & u, const vec3f & v) {return vec3f(u.x + v.x, u.y + v.y, u.z + v.z);}
+inline vec3f operator-(const vec3f & u, const vec3f & v) {return vec3f(u.x - v.x, u.y - v.y, u.z - v.z);}
+inline vec3f operator-(const vec3f & u) {return vec3f(-u.x, -u.y, -u.z);}
+inline vec3f operator*(const vec3f & u, const vec3f & v) {return vec3f(u.x * v.x, u.y * v.y, u.z * v.z);}
+inline vec3f operator*(const vec3f & v, float c) {return vec3f(c * v.x, c * v.y, c * v.z);}
+inline vec3f operator*(float c, const vec3f & v) {return vec3f(c * v.x, c * v.y, c * v.z);}
+
+//rec. 709 luma weights
+inline float luminance(const vec3f & c) {return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;}
+
+//N vectors stored as three arrays, for batches of rays and hits
+template <int N>
+class vec3fN {
 public:
-	vec3f() {}
-	vec3f(float u, float v, float w) {x = u; y = v; z = w;}
+	vec3f get(int i) const {return vec3f(x[i], y[i], z[i]);}
+	void set(int i, const vec3f & v) {x[i] = v.x; y[i] = v.y; z[i] = v.z;}
+	void fill(const vec3f & v) {for (int i = 0; i < N; i++) set(i, v);}
 public:
-	float abs() {return sqrtf(x * x + y * y + z * z);}
-	vec3f * cross(vec3f * b);
-	float dot(vec3f * b) {return x * b->x + y * b->y + z * b->z;}
+	alignas(32) float x[N];
+	alignas(32) float y[N];
+	alignas(32) float z[N];
+};
+
+class matrix3f {
 public:
-	void normalize(); //modifies this vector!
+	matrix3f(float a11, float a12, float a13,
+					 float a21, float a22, float a23,
+					 float a31, float a32, float a33) {
+		data[0][0] = a11; data[0][1] = a12; data[0][2] = a13;
+		data[1][0] = a21; data[1][1] = a22; data[1][2] = a23;
+		data[2][0] = a31; data[2][1] = a32; data[2][2] = a33;
+	}
+	matrix3f() {}
 public:
-	float x; float y; float z;
+	vec3f operator*(const vec3f & x) const {
+		return vec3f(data[0][0] * x.x + data[0][1] * x.y + data[0][2] * x.z,
+								 data[1][0] * x.x + data[1][1] * x.y + data[1][2] * x.z,
+								 data[2][0] * x.x + data[2][1] * x.y + data[2][2] * x.z);
+	}
+	matrix3f operator*(float c) const {
+		matrix3f result;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				result.data[i][j] = c * data[i][j];
+			}
+		}
+		return result;
+	}
+	matrix3f operator*(const matrix3f & b) const {
+		matrix3f result;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				result.data[i][j] = data[i][0] * b.data[0][j] + data[i][1] * b.data[1][j] + data[i][2] * b.data[2][j];
+			}
+		}
+		return result;
+	}
+	matrix3f transpose() const {
+		return matrix3f(data[0][0], data[1][0], data[2][0],
+										data[0][1], data[1][1], data[2][1],
+										data[0][2], data[1][2], data[2][2]);
+	}
+	float det() const {
+		return data[0][0] * (data[1][1] * data[2][2] - data[1][2] * data[2][1])
+				 - data[0][1] * (data[1][0] * data[2][2] - data[1][2] * data[2][0])
+				 + data[0][2] * (data[1][0] * data[2][1] - data[1][1] * data[2][0]);
+	}
+	matrix3f inverse() const {
+		float c = 1.f / det();
+		return matrix3f(data[1][1] * data[2][2] - data[1][2] * data[2][1],
+										data[0][2] * data[2][1] - data[0][1] * data[2][2],
+										data[0][1] * data[1][2] - data[0][2] * data[1][1],
+										data[1][2] * data[2][0] - data[1][0] * data[2][2],
+										data[0][0] * data[2][2] - data[0][2] * data[2][0],
+										data[0][2] * data[1][0] - data[0][0] * data[1][2],
+										data[1][0] * data[2][1] - data[1][1] * data[2][0],
+										data[0][1] * data[2][0] - data[0][0] * data[2][1],
+										data[0][0] * data[1][1] - data[0][1] * data[1][0]) * c;
+	}
+	float at(int i, int j) const {return data[i][j];}
+	void set(int i, int j, float x) {data[i][j] = x;}
+private:
+	float data[3][3];
 };
 
 class Camera {
 public:
 	Camera(float ex, float ey, float ez, float dx, float dy, float dz, float theta, int w, int h);
 public:
-	vec3f * lookat(int x, int y);
+	vec3f lookat(int x, int y) const {
+		x -= width / 2;
+		y -= height / 2;
+		return dir + (u * (float)x + v * (float)y);
+	}
+	//angle between neighbouring pixels near the centre
+	float spread() const {return u.abs() / dir.abs();}
 public:
-	void move(vec3f * e);
-	void point(vec3f * d);
+	void move(const vec3f & e);
+	void point(const vec3f & d);
 	void zoom(float theta);
 	void resize(int w, int h);
 private:
 	void update(float ex, float ey, float ez, float dx, float dy, float dz, float theta, int w, int h);
 public:
-	vec3f *eye, *dir;
+	vec3f eye, dir;
 	float fov;
 	int width, height;
 private:
-	vec3f *u, *v;
+	//one pixel to the right and one down
+	vec3f u, v;
 };
 
 //utility functions
-matrix3f * rotation(float theta, int axis);
-vec3f * mul(vec3f * v, float c);
-vec3f * mul(vec3f * u, vec3f * v);
-vec3f * add(vec3f * u, vec3f * v);
-vec3f * sub(vec3f * u, vec3f * v);
+matrix3f rotation(float theta, int axis);
+matrix3f scaling(float s);
 
 //these don't do much, so they are just structs
 typedef struct {
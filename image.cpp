@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "image.h"
+
+//pixels converted per pwrite when a span is longer
+#define SPAN_CHUNK 256
+
+int image_format(char * fname) {
+	const char * ext = strrchr(fname, '.');
+	if (ext && !strcasecmp(ext, ".pfm")) return IMAGE_PFM;
+	if (ext && !strcasecmp(ext, TILED_EXT)) return IMAGE_TILED;
+	return IMAGE_BMP;
+}
+
+ImageFile::ImageFile() {
+	width = height = 0;
+	format = IMAGE_BMP;
+	tile_size = 0;
+	fd = -1;
+	name = NULL;
+	header = stride = 0;
+	errors = 0;
+	post_init(&post);
+}
+
+ImageFile::~ImageFile() {
+	close();
+}
+
+static void put32(unsigned char * p, uint32_t x) {
+	p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+int ImageFile::open(char * fname, int w, int h, int tile) {
+	close();
+	width = w; height = h;
+	format = image_format(fname);
+	tile_size = tile > 0 ? tile : 16;
+	errors = 0;
+
+	char head[64];
+	size_t size;
+	memset(head, 0, sizeof(head));
+	if (format == IMAGE_BMP) {
+		stride = (w * 3 + 3) & ~3;
+		header = 54;
+		size = header + stride * h;
+		unsigned char * p = (unsigned char *)head;
+		p[0] = 'B'; p[1] = 'M';
+		put32(p + 2, size);
+		put32(p + 10, 54);
+		put32(p + 14, 40);
+		put32(p + 18, w);
+		put32(p + 22, h);
+		p[26] = 1; p[28] = 24;
+	} else if (format == IMAGE_PFM) {
+		//the sign of the scale gives the byte order
+		uint16_t one = 1;
+		stride = (size_t)w * 3 * sizeof(float);
+		header = snprintf(head, sizeof(head), "PF\n%d %d\n%s\n", w, h, *(unsigned char *)&one ? "-1.0" : "1.0");
+		size = header + stride * h;
+	} else {
+		TiledHeader * t = (TiledHeader *)head;
+		memcpy(t->magic, TILED_MAGIC, 4);
+		t->version = TILED_VERSION;
+		t->width = w; t->height = h;
+		t->tile_size = tile_size;
+		t->channels = 3;
+		header = sizeof(TiledHeader);
+		stride = (size_t)tile_size * tile_size * 3 * sizeof(float);
+		size_t tiles = (size_t)((w + tile_size - 1) / tile_size) * ((h + tile_size - 1) / tile_size);
+		size = header + stride * tiles;
+	}
+
+	fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Could not open %s for writing\n", fname);
+		return -1;
+	}
+	//unwritten pixels read back as black until their tile arrives
+	if (pwrite(fd, head, header, 0) != (ssize_t)header || ftruncate(fd, size) < 0) {
+		printf("Could not write %s\n", fname);
+		::close(fd);
+		fd = -1;
+		return -1;
+	}
+	name = strdup(fname);
+	return 0;
+}
+
+//pixels x0 .. x1 - 1 of row y, all within one tile for the tiled format
+void ImageFile::write_span(int x0, int x1, int y, const float * rgb) {
+	unsigned char buf[SPAN_CHUNK * 3 * sizeof(float)];
+	for (int a = x0; a < x1; a += SPAN_CHUNK) {
+		int n = x1 - a < SPAN_CHUNK ? x1 - a : SPAN_CHUNK;
+		const float * src = rgb + 3 * (a - x0);
+		size_t len;
+		off_t offs;
+		if (format == IMAGE_BMP) {
+			//bottom-up BGR
+			post_span(&post, src, buf, n, a, y);
+			for (int i = 0; i < n; i++) {
+				unsigned char r = buf[3 * i];
+				buf[3 * i] = buf[3 * i + 2];
+				buf[3 * i + 2] = r;
+			}
+			len = 3 * n;
+			offs = header + (height - 1 - y) * stride + 3 * a;
+		} else if (format == IMAGE_PFM) {
+			//bottom-up
+			len = 3 * n * sizeof(float);
+			memcpy(buf, src, len);
+			offs = header + (height - 1 - y) * stride + 3 * a * sizeof(float);
+		} else {
+			int tx = a / tile_size, ty = y / tile_size;
+			size_t tile = (size_t)ty * ((width + tile_size - 1) / tile_size) + tx;
+			len = 3 * n * sizeof(float);
+			memcpy(buf, src, len);
+			offs = header + tile * stride + ((y % tile_size) * tile_size + a % tile_size) * 3 * sizeof(float);
+		}
+		if (pwrite(fd, buf, len, offs) != (ssize_t)len) errors++;
+	}
+}
+
+void ImageFile::write_tile(const Tile * t, const float * rgb) {
+	if (fd < 0) return;
+	int w = t->x1 - t->x0;
+	if (format != IMAGE_TILED || t->x0 % tile_size || t->y0 % tile_size || w > tile_size || t->y1 - t->y0 > tile_size) {
+		for (int y = t->y0; y < t->y1; y++) write_span(t->x0, t->x1, y, rgb + 3 * (size_t)(y - t->y0) * w);
+		return;
+	}
+
+	//a whole tile is one write
+	size_t n = (size_t)tile_size * tile_size * 3;
+	float * buf = (float *)calloc(n, sizeof(float));
+	for (int y = t->y0; y < t->y1; y++) {
+		memcpy(buf + 3 * (y - t->y0) * tile_size, rgb + 3 * (size_t)(y - t->y0) * w, 3 * w * sizeof(float));
+	}
+	size_t tile = (size_t)(t->y0 / tile_size) * ((width + tile_size - 1) / tile_size) + t->x0 / tile_size;
+	if (pwrite(fd, buf, n * sizeof(float), header + tile * stride) != (ssize_t)(n * sizeof(float))) errors++;
+	free(buf);
+}
+
+void ImageFile::write_rows(int y0, int y1, const float * rgb) {
+	if (fd < 0) return;
+	int step = format == IMAGE_TILED ? tile_size : width;
+	for (int y = y0; y < y1; y++) {
+		const float * row = rgb + 3 * (size_t)(y - y0) * width;
+		for (int x = 0; x < width; x += step) {
+			write_span(x, x + step < width ? x + step : width, y, row + 3 * x);
+		}
+	}
+}
+
+int ImageFile::close() {
+	if (fd < 0) return 0;
+	int ret = ::close(fd) < 0 || errors > 0 ? -1 : 0;
+	if (ret < 0) printf("Could not write %s\n", name);
+	fd = -1;
+	free(name);
+	name = NULL;
+	return ret;
+}
+
+float * load_image(char * fname, int * w, int * h) {
+	int fmt = image_format(fname);
+	if (fmt == IMAGE_BMP) {
+		printf("%s: only .pfm and %s images hold floats\n", fname, TILED_EXT);
+		return NULL;
+	}
+	FILE * f = fopen(fname, "rb");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return NULL;
+	}
+
+	float * rgb = NULL;
+	bool ok = false;
+	if (fmt == IMAGE_PFM) {
+		char kind[3] = {0, 0, 0};
+		float scale;
+		uint16_t one = 1;
+		if (fscanf(f, "%2s %d %d %f", kind, w, h, &scale) == 4 && !strcmp(kind, "PF") && fgetc(f) != EOF
+				&& *w > 0 && *h > 0 && (scale < 0.f) == (*(unsigned char *)&one == 1)) {
+			size_t row = (size_t)*w * 3;
+			rgb = (float *)malloc(row * *h * sizeof(float));
+			ok = true;
+			for (int y = *h - 1; y >= 0 && ok; y--) {
+				ok = fread(rgb + row * y, sizeof(float), row, f) == row;
+			}
+		}
+	} else {
+		TiledHeader t;
+		if (fread(&t, sizeof(t), 1, f) == 1 && !memcmp(t.magic, TILED_MAGIC, 4) && t.version == TILED_VERSION
+				&& t.channels == 3 && t.tile_size > 0) {
+			*w = t.width; *h = t.height;
+			int ts = t.tile_size, tx = (*w + ts - 1) / ts, ty = (*h + ts - 1) / ts;
+			size_t tile = (size_t)ts * ts * 3;
+			float * buf = (float *)malloc(tile * sizeof(float));
+			rgb = (float *)malloc((size_t)*w * *h * 3 * sizeof(float));
+			ok = true;
+			for (int j = 0; j < ty && ok; j++) {
+				for (int i = 0; i < tx && ok; i++) {
+					ok = fread(buf, sizeof(float), tile, f) == tile;
+					int x1 = (i + 1) * ts < *w ? (i + 1) * ts : *w, y1 = (j + 1) * ts < *h ? (j + 1) * ts : *h;
+					for (int y = j * ts; y < y1 && ok; y++) {
+						memcpy(rgb + 3 * ((size_t)y * *w + i * ts), buf + 3 * (y - j * ts) * ts, 3 * (x1 - i * ts) * sizeof(float));
+					}
+				}
+			}
+			free(buf);
+		}
+	}
+	fclose(f);
+	if (!ok) {
+		printf("Could not read %s\n", fname);
+		free(rgb);
+		return NULL;
+	}
+	return rgb;
+}
@@ -0,0 +1,70 @@
+#ifndef __IMAGE_H
+#define __IMAGE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "tiles.h"
+#include "post.h"
+
+#define TILED_MAGIC "RTTI"
+#define TILED_VERSION 1
+#define TILED_EXT ".rtt"
+
+enum {
+	IMAGE_BMP,   //24 bit, clamped to [0, 1]
+	IMAGE_PFM,   //float RGB, little endian
+	IMAGE_TILED, //float RGB in square tiles, see TiledHeader
+};
+
+//header of the tiled format; followed by the tiles in row-major tile
+//order, each tile_size * tile_size pixels of 3 floats, row-major.
+//edge tiles are padded to full size so every tile has a fixed offset
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t tile_size;
+	uint32_t channels;
+} TiledHeader;
+
+//an image file written in place as the render goes: the file is laid
+//out at its full size when opened and each finished tile or row is
+//written at its own offset with pwrite, so threads need no lock and
+//no frame-sized buffer is kept. rows are top to bottom, whatever the
+//format stores
+class ImageFile {
+public:
+	ImageFile();
+	~ImageFile();
+public:
+	//the format follows the extension; tile_size only matters for
+	//the tiled format
+	int open(char * fname, int w, int h, int tile_size);
+	//rgb holds the tile's rows, (t->x1 - t->x0) pixels each
+	void write_tile(const Tile * t, const float * rgb);
+	//rgb holds whole rows y0 .. y1 - 1
+	void write_rows(int y0, int y1, const float * rgb);
+	int close();
+public:
+	int width, height;
+	int format, tile_size;
+	//how floats become bytes for BMP; float formats are written as is
+	PostParams post;
+private:
+	void write_span(int x0, int x1, int y, const float * rgb);
+private:
+	int fd;
+	char * name;
+	size_t header, stride;
+	//failed writes, reported by close()
+	std::atomic<int> errors;
+};
+
+int image_format(char * fname);
+
+//reads a .pfm or .rtt into a malloc'd row-major RGB float buffer,
+//top row first
+float * load_image(char * fname, int * w, int * h);
+
+#endif
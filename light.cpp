@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "light.h"
+
+//subsamples per cell side when estimating a cell's luminance
+#define LIGHT_SUBSAMPLES 4
+
+RTLights::RTLights(RTScene * s) {
+	scene = s;
+	n_quads = 0;
+	quad_cap = 0;
+	quads = NULL;
+	res = 0;
+	n_cells = 0;
+	power = 0.f;
+	cell_pdf = NULL;
+	prob = NULL;
+	alias = NULL;
+}
+
+RTLights::~RTLights() {
+	free(quads);
+	free(cell_pdf);
+	free(prob);
+	free(alias);
+}
+
+void RTLights::add_quad(int id, int prim_a, int prim_b, vec3f q, vec3f e1, vec3f e2) {
+	if (n_quads == quad_cap) {
+		quad_cap = quad_cap ? 2 * quad_cap : 8;
+		quads = (RTLightQuad *)realloc(quads, quad_cap * sizeof(RTLightQuad));
+	}
+	RTLightQuad * l = &quads[n_quads++];
+	l->id = id;
+	l->prim_a = prim_a; l->prim_b = prim_b;
+	l->q = q; l->e1 = e1; l->e2 = e2;
+	l->n = e1.cross(e2);
+	l->area = l->n.abs();
+	l->n = l->n * (1.f / l->area);
+}
+
+//(s, t) on the quad to a prim and its barycentrics
+inline int quad_prim(const RTLightQuad * l, float s, float t, float * u, float * v) {
+	if (s + t <= 1.f) {
+		*u = s; *v = t;
+		return l->prim_b;
+	}
+	*u = 1.f - s; *v = 1.f - t;
+	return l->prim_a;
+}
+
+int RTLights::build(int r) {
+	res = r;
+	n_cells = n_quads * res * res;
+	if (n_cells == 0) return -1;
+	cell_pdf = (float *)realloc(cell_pdf, n_cells * sizeof(float));
+	prob = (float *)realloc(prob, n_cells * sizeof(float));
+	alias = (int *)realloc(alias, n_cells * sizeof(int));
+
+	//average luminance times area of every cell, looked up at the
+	//cell's size so textures can answer from their mips
+	double total = 0.0;
+	for (int k = 0; k < n_quads; k++) {
+		RTLightQuad * l = &quads[k];
+		float width = sqrtf(l->area) / (res * LIGHT_SUBSAMPLES);
+		for (int j = 0; j < res; j++) {
+			for (int i = 0; i < res; i++) {
+				float y = 0.f;
+				for (int b = 0; b < LIGHT_SUBSAMPLES; b++) {
+					for (int a = 0; a < LIGHT_SUBSAMPLES; a++) {
+						float s = (i + (a + 0.5f) / LIGHT_SUBSAMPLES) / res;
+						float t = (j + (b + 0.5f) / LIGHT_SUBSAMPLES) / res;
+						float u, v;
+						int prim = quad_prim(l, s, t, &u, &v);
+						y += luminance(scene->emit(l->id, prim, u, v, width));
+					}
+				}
+				float w = y / (LIGHT_SUBSAMPLES * LIGHT_SUBSAMPLES) * l->area / (res * res);
+				cell_pdf[(k * res + j) * res + i] = w;
+				total += w;
+			}
+		}
+	}
+	power = (float)total;
+	if (total <= 0.0) return -1;
+
+	//keep every cell reachable, a coarse average can miss a few
+	//bright texels
+	float floor = 0.01f * (float)(total / n_cells);
+	total += floor * n_cells;
+	for (int c = 0; c < n_cells; c++) {
+		cell_pdf[c] = (cell_pdf[c] + floor) / (float)total;
+	}
+
+	//Vose's alias method
+	int * small = (int *)malloc(n_cells * sizeof(int));
+	int * large = (int *)malloc(n_cells * sizeof(int));
+	int ns = 0, nl = 0;
+	for (int c = 0; c < n_cells; c++) {
+		prob[c] = cell_pdf[c] * n_cells;
+		alias[c] = c;
+		if (prob[c] < 1.f) small[ns++] = c;
+		else large[nl++] = c;
+	}
+	while (ns > 0 && nl > 0) {
+		int s = small[--ns], l = large[nl - 1];
+		alias[s] = l;
+		prob[l] -= 1.f - prob[s];
+		if (prob[l] < 1.f) {
+			nl--;
+			small[ns++] = l;
+		}
+	}
+	while (nl > 0) prob[large[--nl]] = 1.f;
+	while (ns > 0) prob[small[--ns]] = 1.f;
+	free(small);
+	free(large);
+	return 0;
+}
+
+bool RTLights::sample(const vec3f & p, float u1, float u2, vec3f * dir, float * dist, vec3f * radiance, float * pdf) const {
+	if (n_cells == 0) return false;
+
+	//pick a cell, reusing what's left of u1 inside it
+	float x = u1 * n_cells;
+	int c = (int)x;
+	if (c >= n_cells) c = n_cells - 1;
+	x -= c;
+	if (x < prob[c]) {
+		x /= prob[c];
+	} else {
+		x = (x - prob[c]) / (1.f - prob[c]);
+		c = alias[c];
+	}
+	if (x >= 1.f) x = 0.99999994f;
+
+	int k = c / (res * res);
+	int i = c % res, j = (c / res) % res;
+	const RTLightQuad * l = &quads[k];
+	float s = (i + x) / res, t = (j + u2) / res;
+
+	vec3f d = l->q + l->e1 * s + l->e2 * t - p;
+	float d2 = d.dot(d);
+	float len = sqrtf(d2);
+	if (len == 0.f) return false;
+	d = d * (1.f / len);
+	float cos_l = fabsf(l->n.dot(d));
+	if (cos_l < 1e-6f) return false;
+
+	float u, v;
+	int prim = quad_prim(l, s, t, &u, &v);
+	*dir = d;
+	*dist = len;
+	*radiance = scene->emit(l->id, prim, u, v, 0.f);
+	*pdf = cell_pdf[c] * (res * res) / l->area * d2 / cos_l;
+	return true;
+}
+
+float RTLights::pdf(int id, int prim, float u, float v, const vec3f & dir, float dist) const {
+	for (int k = 0; k < n_quads; k++) {
+		const RTLightQuad * l = &quads[k];
+		if (l->id != id || (prim != l->prim_a && prim != l->prim_b)) continue;
+
+		float s = prim == l->prim_b ? u : 1.f - u;
+		float t = prim == l->prim_b ? v : 1.f - v;
+		int i = (int)(s * res), j = (int)(t * res);
+		if (i >= res) i = res - 1;
+		if (j >= res) j = res - 1;
+		if (i < 0) i = 0;
+		if (j < 0) j = 0;
+
+		float cos_l = fabsf(l->n.dot(dir));
+		if (cos_l < 1e-6f) return 0.f;
+		return cell_pdf[(k * res + j) * res + i] * (res * res) / l->area * dist * dist / cos_l;
+	}
+	return 0.f;
+}
@@ -0,0 +1,54 @@
+#ifndef __LIGHT_H
+#define __LIGHT_H
+
+#include "geom.h"
+#include "RTObject.h"
+
+//an emissive quad made of two triangles of one object: triangle b has
+//corners q, q+e1, q+e2 and triangle a the opposite corner q+e1+e2
+typedef struct {
+	int id;
+	int prim_a, prim_b;
+	vec3f q, e1, e2;
+	vec3f n;
+	float area;
+} RTLightQuad;
+
+//picks points on emitters in proportion to their luminance, from a
+//piecewise-constant table of res x res cells per quad
+class RTLights {
+public:
+	RTLights(RTScene * s);
+	~RTLights();
+public:
+	void add_quad(int id, int prim_a, int prim_b, vec3f q, vec3f e1, vec3f e2);
+	int build(int res);
+public:
+	//direction, distance and radiance of a point on a light seen from
+	//p; *pdf is per solid angle. false if the point is degenerate
+	bool sample(const vec3f & p, float u1, float u2, vec3f * dir, float * dist, vec3f * radiance, float * pdf) const;
+	//solid angle pdf that sample() picks the point hit at distance
+	//dist along dir; 0 if the prim is not part of a light
+	float pdf(int id, int prim, float u, float v, const vec3f & dir, float dist) const;
+public:
+	int n_quads;
+	int res;
+	float power;
+private:
+	RTScene * scene;
+	RTLightQuad * quads;
+	int quad_cap;
+	//alias table over all cells
+	int n_cells;
+	float * cell_pdf;
+	float * prob;
+	int * alias;
+};
+
+//power heuristic for two strategies with one sample each
+inline float mis_weight(float pdf_a, float pdf_b) {
+	float a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+	return a + b > 0.f ? a / (a + b) : 0.f;
+}
+
+#endif
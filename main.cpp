@@ -6,162 +6,614 @@
 #include <math.h>
 #include <time.h>
 #include <float.h>
+#include <unistd.h>
+#include <thread>
 
 #include "geom.h"
-#include "bmpc.h"
+#include "image.h"
 #include "brdf.h"
+#include "render.h"
 #include "RTObject.h"
+#include "light.h"
+#include "scene.h"
+#include "denoise.h"
+#include "stats.h"
+
+int parse_quality(char * s) {
+	if (!strcmp(s, "low")) return RTC_BUILD_QUALITY_LOW;
+	if (!strcmp(s, "medium")) return RTC_BUILD_QUALITY_MEDIUM;
+	if (!strcmp(s, "high")) return RTC_BUILD_QUALITY_HIGH;
+	if (!strcmp(s, "refit")) return RTC_BUILD_QUALITY_REFIT;
+	return -1;
+}
 
-inline void setRayDir(RTCRayHit * rh, vec3f * dir) {
-	rh->ray.dir_x = dir->x;
-	rh->ray.dir_y = dir->y;
-	rh->ray.dir_z = dir->z;
+int parse_filter(char * s) {
+	if (!strcmp(s, "nearest")) return TEX_NEAREST;
+	if (!strcmp(s, "bilinear")) return TEX_BILINEAR;
+	if (!strcmp(s, "trilinear")) return TEX_TRILINEAR;
+	return -1;
 }
 
-inline void setRayOrg(RTCRayHit * rh, vec3f * org) {
-	rh->ray.org_x = org->x;
-	rh->ray.org_y = org->y;
-	rh->ray.org_z = org->z;
+int parse_flags(char * s) {
+	int flags = RTC_SCENE_FLAG_NONE;
+	for (char * tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+		if (!strcmp(tok, "robust")) flags |= RTC_SCENE_FLAG_ROBUST;
+		else if (!strcmp(tok, "compact")) flags |= RTC_SCENE_FLAG_COMPACT;
+		else if (!strcmp(tok, "dynamic")) flags |= RTC_SCENE_FLAG_DYNAMIC;
+		else return -1;
+	}
+	return flags;
 }
 
-inline vec3f * local_u(vec3f * hit_n) {
-	vec3f * hit_u;
-	hit_u = new vec3f(-hit_n->y, hit_n->x, 0.f);
-	if (hit_u->abs() == 0.f) {
-		hit_u = new vec3f(0.f, -hit_n->z, hit_n->y);
+void usage() {
+	printf("Usage: embree_test [options] file.obj|file.scene [samples]\n");
+	printf("  -j N     render with N threads (default: all cores)\n");
+	printf("  -s SEED  random seed; a fixed seed gives the same image for any -j\n");
+	printf("  -t SIZE  tile size in pixels (default 16)\n");
+	printf("  -C       don't read or write .rtm mesh caches beside OBJ files\n");
+	printf("  -q Q     scene BVH quality: low, medium (default) or high\n");
+	printf("  -g Q     mesh BVH quality: low, medium (default), high or refit\n");
+	printf("  -f FLAGS scene flags, comma separated: robust, compact, dynamic\n");
+	printf("  -v       report each BVH build\n");
+	printf("  -i N     .obj only: place N instances of the mesh on a grid instead of one copy\n");
+	printf("  -P N     progressive: render passes of N spp until [samples] spp\n");
+	printf("  -T SEC   progressive: stop before the wall-clock budget runs out\n");
+	printf("  -k FILE  progressive: checkpoint after each pass, resume from FILE\n");
+	printf("  -A ERR   adaptive: stop sampling pixels whose relative error is below ERR\n");
+	printf("           (implies -P 4 if not given); [samples] is the maximum spp\n");
+	printf("  -n N     adaptive: minimum spp before a pixel may stop (default 2 passes)\n");
+	printf("  -o FILE  output image (default out.bmp); .pfm and .rtt (tiled) keep floats\n");
+	printf("  -e EV    BMP output: exposure in stops\n");
+	printf("  -M TONE  BMP output: clamp (default), aces or filmic; the curves add sRGB and dithering\n");
+	printf("  -D       denoise the output, guided by the camera hit's albedo, normal and depth\n");
+	printf("  -a NAME  write the albedo, normal, depth and object id to NAME.albedo.pfm etc.\n");
+	printf("  -J FILE  append a JSON line of stage timings to FILE, with $RT_COMMIT as its commit\n");
+	printf("  -Y       with -J: split render time into primary, GI and shading (times every trace call)\n");
+	printf("  -X FILE  write hot path counters and timers to FILE (.json or .csv) at exit; needs make STATS=1\n");
+	printf("  -p I/N   job I (from 0) of N: render every Nth tile only\n");
+	printf("  -O N     start each pixel's samples at sample N, so jobs can split the samples\n");
+	printf("  -W FILE  write the sample sums and counts to FILE for rtmerge instead of an image;\n");
+	printf("           jobs default to seed 0 so they agree\n");
+	printf("  -L N     render a sequence of N frames (default: the scene file's frames); frame k\n");
+	printf("           goes to the -o name with %%d filled in, or with _000k before the extension\n");
+	printf("  -H FILE  write a heat map of samples per pixel to FILE\n");
+	printf("  -S KIND  GI directions: uniform, cosine or sobol (cosine, Owen-scrambled; default)\n");
+	printf("  -F MODE  sky texture filter: nearest, bilinear or trilinear (default)\n");
+	printf("  -d N     maximum path length in bounces (default 4)\n");
+	printf("  -c MAT   .obj only: the mesh's material, lambert (default), ggx:ROUGHNESS or glass:IOR\n");
+	printf("  -E FILE  .obj only: light the scene with an equirectangular .hdr or .pfm instead of the skybox\n");
+	printf("  -R DEG   environment: turn it DEG degrees about the vertical\n");
+	printf("  -I K     environment: scale its radiance by K (default 1)\n");
+	printf("  -N       no light sampling, find the sky with GI rays alone\n");
+	printf("  -m MODE  scalar: one ray at a time (default)\n");
+	printf("           packet: 8-wide camera packets, streamed GI rays\n");
+}
+
+//filters the accumulated means and writes them in place of the noisy image
+static int write_denoised(Accum * accum, AOV * aov, const DenoiseParams * dp, int n_threads,
+		char * name, const PostParams * post, int tile_size, double * seconds) {
+	int w = accum->width, h = accum->height;
+	float * rgb = (float *)malloc(3 * (size_t)w * h * sizeof(float));
+	float * var = (float *)malloc((size_t)w * h * sizeof(float));
+	accum->resolve(rgb);
+	accum->variance(var);
+	double t = wall_time();
+	denoise(dp, aov, var, rgb, n_threads);
+	*seconds = wall_time() - t;
+	printf("Denoised in %.2f s\n", *seconds);
+
+	ImageFile image;
+	image.post = *post;
+	int ret = image.open(name, w, h, tile_size);
+	if (ret == 0) {
+		image.write_rows(0, h, rgb);
+		ret = image.close();
 	}
-	hit_u->normalize();
-	return hit_u;
+	free(rgb);
+	free(var);
+	return ret;
 }
 
-inline float rangle() {
-	return (float)(M_PI * (double)(rand())/(double)(RAND_MAX));
+//frame k of a sequence: the name's %d (or %04d etc.) if it has one,
+//else the name with _000k before its extension
+static void frame_name(char * pattern, int frame, char * out, size_t len) {
+	char * pc = strchr(pattern, '%');
+	if (pc) {
+		size_t n = strspn(pc + 1, "0123456789");
+		if (pc[1 + n] == 'd' && !strchr(pc + 2 + n, '%')) {
+			snprintf(out, len, pattern, frame);
+			return;
+		}
+	}
+	char * dot = strrchr(pattern, '.');
+	char * slash = strrchr(pattern, '/');
+	if (!dot || (slash && dot < slash)) dot = pattern + strlen(pattern);
+	snprintf(out, len, "%.*s_%04d%s", (int)(dot - pattern), pattern, frame, dot);
 }
 
-inline vec3f * random_dir(vec3f * n, float backside) {
-	vec3f * u = local_u(n);
-	vec3f * v = n->cross(u);
+static void write_frame(Accum * accum, char * name, const PostParams * post, int tile_size, int * ret) {
+	ImageFile image;
+	image.post = *post;
+	*ret = image.open(name, accum->width, accum->height, tile_size);
+	if (*ret == 0) {
+		accum->resolve(&image);
+		*ret = image.close();
+	}
+}
 
-	float hit_theta = rangle() - M_PI / 2.f, hit_phi = rangle() * 2.f;
+//renders frames 0 .. frames - 1 with the scene loaded and built once.
+//frames take turns at two sample buffers, so frame k is written on its
+//own thread while frame k + 1 renders; wait_seconds is the time spent
+//waiting on the writer anyway. the renderer's counts end up as the sums
+//over all frames
+static int render_sequence(RTScene * scene, const SceneSetup * setup, RTRenderer * r, int frames,
+		char * pattern, const PostParams * post, int tile_size, double * wait_seconds) {
+	Accum * buf[2] = {new Accum(r->width, r->height), new Accum(r->width, r->height)};
+	char names[2][4096];
+	int rets[2] = {0, 0};
+	std::thread writer;
+	long rays = 0, paths = 0, segments = 0;
+	double seconds = 0.0, primary = 0.0, gi = 0.0, shade = 0.0, write = 0.0;
+	*wait_seconds = 0.0;
+
+	int ret = 0;
+	for (int k = 0; k < frames && ret == 0; k++) {
+		Accum * a = buf[k % 2];
+		//frame 0 is where main() left the scene
+		double t0 = wall_time();
+		if (k > 0) {
+			setup_frame(scene, setup, k);
+			if (setup->n_moving > 0) scene->commit();
+		}
+		double moved = wall_time() - t0;
+
+		a->clear();
+		r->accum = a;
+		r->render();
+		r->accum = NULL;
+		rays += r->rays; paths += r->paths; segments += r->segments;
+		seconds += r->seconds;
+		primary += r->primary_seconds; gi += r->gi_seconds; shade += r->shade_seconds; write += r->write_seconds;
+
+		//the last frame's writer had all of this render to finish in
+		t0 = wall_time();
+		if (writer.joinable()) {
+			writer.join();
+			if (rets[(k + 1) % 2] < 0) ret = -1;
+		}
+		*wait_seconds += wall_time() - t0;
+		frame_name(pattern, k, names[k % 2], sizeof(names[k % 2]));
+		writer = std::thread(write_frame, a, names[k % 2], post, tile_size, &rets[k % 2]);
+		printf("Frame %d: %s, rendered in %.2f s, scene moved in %.2f ms\n", k, names[k % 2], r->seconds, moved * 1e3);
+	}
+	double t0 = wall_time();
+	if (writer.joinable()) {
+		writer.join();
+		if (rets[0] < 0 || rets[1] < 0) ret = -1;
+	}
+	*wait_seconds += wall_time() - t0;
+
+	r->rays = rays; r->paths = paths; r->segments = segments;
+	r->seconds = seconds;
+	r->primary_seconds = primary; r->gi_seconds = gi; r->shade_seconds = shade; r->write_seconds = write;
+	delete buf[0];
+	delete buf[1];
+	return ret;
+}
 
-	float c_u = sinf(hit_theta) * cosf(hit_phi);
-	float c_v = sinf(hit_theta) * sinf(hit_phi);
-	float c_n = cosf(hit_theta) * backside;
-	vec3f * out_dir = add(add(mul(u, c_u), mul(v, c_v)), mul(n, c_n));
-	out_dir->normalize();
+static int save_samples(Accum * accum, char * name) {
+	if (accum->save(name) < 0) {
+		printf("Could not write %s\n", name);
+		return -1;
+	}
+	return 0;
+}
 
-	return out_dir;
+//one run's stage timings, for -J
+typedef struct {
+	char * scene;
+	int width, height, spp, threads;
+	int mode, sampling;
+	unsigned int seed;
+	long rays;
+	double load, textures, bvh, render;
+	//primary, gi and shading are only known when split, and write
+	//only has the tile writes inside the render then
+	bool split;
+	double primary, gi, shading, write, denoise;
+	double total;
+} BenchRun;
+
+static void json_string(FILE * f, const char * s) {
+	fputc('"', f);
+	for (const char * c = s; *c; c++) {
+		if (*c == '"' || *c == '\\') fputc('\\', f);
+		fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+//appends the run as one line of JSON, so a bench is a file of runs
+static int write_bench(char * fname, const BenchRun * b) {
+	FILE * f = fopen(fname, "a");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+	//the commit is whatever the caller says it is; make bench passes git's
+	char * commit = getenv("RT_COMMIT");
+	fprintf(f, "{\"scene\": ");
+	json_string(f, b->scene);
+	fprintf(f, ", \"commit\": ");
+	json_string(f, commit && *commit ? commit : "unknown");
+	fprintf(f, ", \"width\": %d, \"height\": %d, \"spp\": %d, \"threads\": %d, ", b->width, b->height, b->spp, b->threads);
+	fprintf(f, "\"mode\": \"%s\", \"sampler\": \"%s\", \"seed\": %u, ", b->mode == TRACE_PACKET ? "packet" : "scalar",
+		sampler_name(b->sampling), b->seed);
+	fprintf(f, "\"rays\": %ld, \"mrays_per_s\": %.3f, ", b->rays, b->render > 0.0 ? b->rays / b->render * 1e-6 : 0.0);
+	fprintf(f, "\"seconds\": {\"load\": %.4f, \"textures\": %.4f, \"bvh\": %.4f, \"render\": %.4f, ",
+		b->load, b->textures, b->bvh, b->render);
+	if (b->split) fprintf(f, "\"primary\": %.4f, \"gi\": %.4f, \"shading\": %.4f, ", b->primary, b->gi, b->shading);
+	else fprintf(f, "\"primary\": null, \"gi\": null, \"shading\": null, ");
+	fprintf(f, "\"write\": %.4f, \"denoise\": %.4f, \"total\": %.4f}}\n", b->write, b->denoise, b->total);
+	return fclose(f) == 0 ? 0 : -1;
 }
 
 int main(int argc, char** argv) {
 	int n_samples = 16;
+	int n_threads = std::thread::hardware_concurrency();
+	int tile_size = 16;
+	int mode = TRACE_SCALAR;
+	int sampling = SAMPLE_SOBOL;
+	bool sample_lights = true;
+	int max_depth = 4;
+	int filter = TEX_TRILINEAR;
+	bool use_cache = true;
+	int scene_q = RTC_BUILD_QUALITY_MEDIUM, geom_q = RTC_BUILD_QUALITY_MEDIUM;
+	int flags = RTC_SCENE_FLAG_NONE;
+	bool verbose = false;
+	int n_instances = 0;
+	int pass_samples = 0;
+	double budget = 0.0;
+	char * checkpoint = NULL;
+	float threshold = 0.f;
+	int min_spp = -1;
+	char * heat = NULL;
+	char * out_name = (char*)"out.bmp";
+	PostParams post;
+	post_init(&post);
+	bool bad_tone = false;
+	char * hdri = NULL;
+	bool use_denoise = false;
+	char * aov_name = NULL;
+	char * bench_name = NULL;
+	bool split_stages = false;
+	char * partial_name = NULL;
+	int part = 0, parts = 1;
+	long sample_offset = 0;
+	bool seed_set = false;
+	int frames = 0;
+	Material material;
+	material_init(&material);
+	bool bad_material = false;
+	float hdri_rotation = 0.f, hdri_intensity = 1.f;
+	unsigned int seed = time(0);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "j:s:t:m:Cq:g:f:vi:P:T:k:A:n:H:S:Nd:F:E:R:I:o:e:M:Da:J:YX:p:O:W:L:c:h")) != -1) {
+		switch (opt) {
+		case 'j': n_threads = atoi(optarg); break;
+		case 's': seed = strtoul(optarg, NULL, 10); seed_set = true; break;
+		case 't': tile_size = atoi(optarg); break;
+		case 'C': use_cache = false; break;
+		case 'q': scene_q = parse_quality(optarg); break;
+		case 'g': geom_q = parse_quality(optarg); break;
+		case 'f': flags = parse_flags(optarg); break;
+		case 'v': verbose = true; break;
+		case 'i': n_instances = atoi(optarg); break;
+		case 'P': pass_samples = atoi(optarg); break;
+		case 'T': budget = atof(optarg); break;
+		case 'k': checkpoint = optarg; break;
+		case 'A': threshold = atof(optarg); break;
+		case 'n': min_spp = atoi(optarg); break;
+		case 'H': heat = optarg; break;
+		case 'D': use_denoise = true; break;
+		case 'a': aov_name = optarg; break;
+		case 'J': bench_name = optarg; break;
+		case 'Y': split_stages = true; break;
+		case 'X': if (stats_report_at_exit(optarg) < 0) return -1; break;
+		case 'p': if (sscanf(optarg, "%d/%d", &part, &parts) != 2) parts = 0; break;
+		case 'O': sample_offset = atol(optarg); break;
+		case 'W': partial_name = optarg; break;
+		case 'L': frames = atoi(optarg); break;
+		case 'c': {
+			char * param = strchr(optarg, ':');
+			if (param) *param++ = 0;
+			bad_material = parse_material(optarg, param, &material) < 0;
+			break;
+		}
+		case 'o': out_name = optarg; break;
+		case 'e': post.exposure = atof(optarg); break;
+		case 'M': bad_tone = post_set_tone(&post, optarg) < 0; break;
+		case 'S': sampling = parse_sampler(optarg); break;
+		case 'N': sample_lights = false; break;
+		case 'd': max_depth = atoi(optarg); break;
+		case 'F': filter = parse_filter(optarg); break;
+		case 'E': hdri = optarg; break;
+		case 'R': hdri_rotation = atof(optarg) * (float)M_PI / 180.f; break;
+		case 'I': hdri_intensity = atof(optarg); break;
+		case 'm':
+			if (!strcmp(optarg, "scalar")) mode = TRACE_SCALAR;
+			else if (!strcmp(optarg, "packet")) mode = TRACE_PACKET;
+			else {usage(); return -1;}
+			break;
+		default: usage(); return -1;
+		}
+	}
+
 	//print a message and quit if no args
-	if (argc < 2) {
+	if (optind >= argc) {
 		printf("Please give a file name\n");
 		return -1;
 	}
-	if (argc > 2) {
-		n_samples = atoi(argv[2]);
+	char * fname = argv[optind];
+	if (optind + 1 < argc) {
+		n_samples = atoi(argv[optind + 1]);
+	}
+	if (n_threads < 1) n_threads = 1;
+	if (tile_size < 1) tile_size = 16;
+	if (max_depth < 1) max_depth = 1;
+	if (threshold > 0.f && pass_samples <= 0) pass_samples = 4;
+	if (min_spp < 0) min_spp = 2 * pass_samples;
+	if (scene_q < 0 || scene_q == RTC_BUILD_QUALITY_REFIT || geom_q < 0 || flags < 0 || sampling < 0 || filter < 0 || bad_tone || bad_material
+			|| parts < 1 || part < 0 || part >= parts || sample_offset < 0 || frames < 0) {
+		usage();
+		return -1;
+	}
+	//a job's samples only fit with the others' if they share the seed
+	if (!seed_set && (partial_name || parts > 1 || sample_offset > 0)) seed = 0;
+	if (partial_name && use_denoise) {
+		printf("A job writing samples can't denoise; denoising needs the whole frame\n");
+		return -1;
 	}
-
-	//random seed
-	srand(time(0));
 
 	//create a new scene
 	RTScene scene;
+	scene.set_quality((RTCBuildQuality)scene_q, (RTCBuildQuality)geom_q);
+	scene.set_flags((RTCSceneFlags)flags);
+	scene.verbose = verbose;
+
+	SceneSetup setup;
+	default_setup(&setup);
+	RTSkyBox * sky = NULL;
+	double start = wall_time();
+
+	if (is_scene_file(fname)) {
+		if (load_scene(&scene, fname, &setup, n_threads, use_cache) < 0) {
+			scene.cleanup();
+			return -1;
+		}
+		sky = setup.sky;
+		if (sky) sky->sides.filter = sky->bottom.filter = sky->top.filter = filter;
+		if (scene.env) scene.env->filter = filter;
+		printf("Loaded %s: %d meshes in %d placements in %.1f ms\n", fname, setup.n_meshes, setup.n_placements,
+			setup.load_seconds * 1e3);
+	} else {
+		//load a skybox, or an environment that misses look up directly
+		double t0 = wall_time();
+		if (hdri) {
+			if (scene.set_hdri(hdri, hdri_rotation, hdri_intensity) < 0) {
+				scene.cleanup();
+				return -1;
+			}
+			scene.env->filter = filter;
+			printf("Loaded environment %s, %dx%d\n", hdri, scene.env->width, scene.env->height);
+		} else {
+			sky = new RTSkyBox(&scene, 30.f, vec3f(0.f, 0.f, 0.f));
+			if (sky->loadFile((char*)"textures/bliss.bmp", (char*)"textures/grass.bmp", (char*)"textures/cloud.bmp") < 0) {
+				scene.cleanup();
+				return -1;
+			}
+			sky->sides.filter = sky->bottom.filter = sky->top.filter = filter;
+		}
+		setup.texture_seconds = wall_time() - t0;
+
+		//load a mesh into the scene
+		RTTriangleMesh * teapot = new RTTriangleMesh(&scene, material, emit_black, n_instances > 0);
+		teapot->use_cache = use_cache;
+		t0 = wall_time();
+		if (teapot->loadFile(fname) < 0) {
+			scene.cleanup();
+			return -1;
+		}
+		double t1 = wall_time() - t0;
+		printf("Loaded %s with %d vertices and %d faces in %.1f ms (%.0f MB/s%s)\n", fname,
+			teapot->num_vertices, teapot->num_triangles, t1 * 1e3, teapot->file_size / t1 * 1e-6,
+			teapot->cached ? ", cached" : "");
+
+		//copies on a square grid in the mesh's ground plane, each turned a bit
+		if (n_instances > 0) {
+			RTCBounds b;
+			rtcGetSceneBounds(teapot->proto, &b);
+			float step = 1.5f * fmaxf(b.upper_x - b.lower_x, b.upper_z - b.lower_z);
+			int side = (int)ceilf(sqrtf((float)n_instances));
+			for (int i = 0; i < n_instances; i++) {
+				float x = (i % side - side / 2) * step;
+				float z = (i / side - side / 2) * step;
+				RTInstance * inst = new RTInstance(&scene, teapot, rotation(0.7f * i, AXIS_Y), vec3f(x, 0.f, z));
+				if (inst->id < 0) {
+					delete inst;
+					scene.cleanup();
+					return -1;
+				}
+			}
+			printf("Placed %d instances\n", n_instances);
+		}
+		setup.load_seconds = wall_time() - start;
+	}
 
-	//load a skybox
-	RTSkyBox * sky = new RTSkyBox(&scene, 30.f, new vec3f(0.f, 0.f, 0.f));
-	sky->loadFile((char*)"textures/bliss.bmp", (char*)"textures/grass.bmp", (char*)"textures/cloud.bmp", 1440, 1440);
-
-	//load a mesh into the scene
-	RTTriangleMesh * teapot = new RTTriangleMesh(&scene, brdf_lambert, emit_black);
-	teapot->loadFile(argv[1]);
-	printf("Loaded %s with %d vertices and %d faces\n", argv[1], teapot->num_vertices, teapot->num_triangles);
+	if (frames == 0) frames = setup.frames;
+	if (frames > 1 && (pass_samples > 0 || checkpoint || partial_name || parts > 1 || sample_offset > 0
+			|| use_denoise || aov_name || heat)) {
+		printf("A sequence renders each frame whole in one pass; -P, -A, -k, -W, -p, -O, -D, -a and -H don't apply\n");
+		free_setup(&setup);
+		scene.cleanup();
+		return -1;
+	}
+	//moving placements change only their instances' transforms, so the
+	//top level is rebuilt each frame and the meshes' BVHs never are
+	if (frames > 1 && setup.n_moving > 0) scene.set_flags((RTCSceneFlags)(flags | RTC_SCENE_FLAG_DYNAMIC));
 
 	//commit scene and build BVH
+	setup_frame(&scene, &setup, 0);
 	scene.commit();
+	double bvh_seconds = scene.geom_seconds + scene.scene_seconds;
+	printf("Built BVH in %.1f ms (%.1f ms geometry, %.1f ms scene), %.2f MB\n",
+		(scene.geom_seconds + scene.scene_seconds) * 1e3, scene.geom_seconds * 1e3, scene.scene_seconds * 1e3,
+		(scene.geom_bytes + scene.scene_bytes) / 1048576.0);
+
+	//importance table over the sky; the environment is only found by
+	//GI rays that escape
+	RTLights lights(&scene);
+	if (!sky) sample_lights = false;
+	if (sample_lights) {
+		sky->add_lights(&lights);
+		if (lights.build(64) < 0) sample_lights = false;
+	}
 
-	//output file
-	BMPC output(1000, 1000);
-
-	//camera location
-	scene.move(5.f, 8.f, 0.f);
-	scene.point(-1.f, -1.5f, 0.f);
-	scene.zoom(0.8f);
-	scene.resize(output.width, output.height);
-
-	vec3f *last_dir, *last_color;
-	vec3f * emission;
-	int last_id, last_prim;
-	float refl;
-
-	for (int u = 0; u < output.width; u++) {
-		for (int v = 0; v < output.height; v++) {
-			scene.resetRH();
-
-			setRayOrg(&scene.rh, scene.cam->eye);
-			setRayDir(&scene.rh, scene.cam->lookat(u, v));
-
-			rtcIntersect1(scene.scene, &scene.context, &scene.rh);
-
-			//fill with background color
-			if (scene.rh.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
-				output.set_px(u, v, 0.f, 0.f, 0.f);	
-				continue;
+	//the camera was placed with frame 0
+	scene.resize(setup.width, setup.height);
+
+	//trace
+	RTRenderer renderer(&scene, setup.width, setup.height);
+	renderer.n_samples = n_samples;
+	renderer.n_threads = n_threads;
+	renderer.tile_size = tile_size;
+	renderer.mode = mode;
+	renderer.sampling = sampling;
+	renderer.lights = sample_lights ? &lights : NULL;
+	renderer.max_depth = max_depth;
+	renderer.seed = seed;
+	renderer.timing = bench_name && split_stages;
+	renderer.part = part;
+	renderer.parts = parts;
+	renderer.sample_offset = (uint32_t)sample_offset;
+	AOV * aov = use_denoise || aov_name ? new AOV(setup.width, setup.height) : NULL;
+	renderer.features = aov;
+	DenoiseParams dp;
+	denoise_init(&dp);
+	int ret = 0;
+	//writing the image after the render, and denoising it
+	double out_seconds = 0.0, denoise_seconds = 0.0;
+
+	if (frames > 1) {
+		ret = render_sequence(&scene, &setup, &renderer, frames, out_name, &post, tile_size, &out_seconds);
+	} else if (pass_samples > 0) {
+		Accum accum(setup.width, setup.height);
+		accum.seed = seed;
+		if (checkpoint && access(checkpoint, F_OK) == 0) {
+			if (accum.load(checkpoint) < 0) {
+				scene.cleanup();
+				return -1;
 			}
-
-			//hit point, normal vector
-			vec3f * hit_p = scene.hitP();
-			vec3f * hit_n = scene.hitN();
-
-			//store last hit
-			last_id = scene.rh.hit.geomID;
-			last_prim = scene.rh.hit.primID;
-			last_dir = new vec3f(scene.rh.ray.dir_x, scene.rh.ray.dir_y, scene.rh.ray.dir_z);
-			last_color = scene.color(last_id, last_prim, scene.rh.hit.u, scene.rh.hit.v);
-
-			//direct (just emission for now)
-			vec3f * d_illum = scene.emit(scene.rh.hit.geomID, scene.rh.hit.primID, scene.rh.hit.u, scene.rh.hit.v);
-
-			//do GI
-			float hit_theta, hit_phi;
-			vec3f * g_illum = new vec3f(0.f, 0.f, 0.f);	
-
-			for (int sample = 0; sample < n_samples; sample++) {
-				float backside = last_dir->dot(hit_n) > 0.f ? -1.f : 1.f;
-				vec3f * out_dir = random_dir(hit_n, backside);
-				float cos_g = backside * hit_n->dot(out_dir);
-				refl = scene.reflect(last_id, last_prim, 0.f, 0.f, 0.f, 0.f); //TODO: use real angles!
-
-				if (refl == 0.f) continue; //trick to speed up the skybox
-
-				//one GI bounce
-				scene.resetRH();
-				setRayOrg(&scene.rh, hit_p);
-				setRayDir(&scene.rh, out_dir);
-
-				rtcIntersect1(scene.scene, &scene.context, &scene.rh);
-
-				if (scene.rh.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
-					continue;
-				}
-				
-				//add the emission from the new hit
-				emission = scene.emit(scene.rh.hit.geomID, scene.rh.hit.primID, scene.rh.hit.u, scene.rh.hit.v);
-				g_illum = add(g_illum, mul(mul(last_color, cos_g * refl), emission));
+			renderer.seed = accum.seed;
+			printf("Resuming from %s after %d passes\n", checkpoint, accum.passes);
+		}
+		renderer.accum = &accum;
+		renderer.n_samples = pass_samples;
+		renderer.threshold = threshold;
+		renderer.min_spp = min_spp;
+		//each pass rewrites the output; with no passes left, write it once
+		int passes = renderer.progressive(n_samples, budget, checkpoint, partial_name ? NULL : out_name, &post);
+		double t0 = wall_time();
+		if (partial_name) {
+			ret = save_samples(&accum, partial_name);
+		} else if (use_denoise && passes > 0) {
+			ret = write_denoised(&accum, aov, &dp, n_threads, out_name, &post, tile_size, &denoise_seconds);
+		} else if (passes == 0) {
+			if (use_denoise) printf("No passes were rendered, so there are no features to denoise with\n");
+			ImageFile image;
+			image.post = post;
+			ret = image.open(out_name, setup.width, setup.height, tile_size);
+			if (ret == 0) {
+				accum.resolve(&image);
+				ret = image.close();
 			}
-			g_illum = mul(g_illum, 1.f / (float)n_samples);
-
-			//direct + global
-			vec3f * illum = add(d_illum, g_illum);
-			
-			//write output color
-			output.set_px(u, v, illum->x, illum->y, illum->z);
 		}
+		out_seconds = wall_time() - t0;
+		renderer.accum = NULL;
+		ImageFile map;
+		if (heat) {
+			int r = map.open(heat, setup.width, setup.height, tile_size);
+			if (r == 0) {
+				accum.heat_map(&map);
+				r = map.close();
+			}
+			if (r < 0) ret = -1;
+		}
+	} else if (partial_name) {
+		Accum accum(setup.width, setup.height);
+		accum.seed = seed;
+		renderer.accum = &accum;
+		renderer.render();
+		renderer.accum = NULL;
+		accum.passes = 1;
+		double t0 = wall_time();
+		ret = save_samples(&accum, partial_name);
+		out_seconds = wall_time() - t0;
+	} else if (use_denoise) {
+		//the filter needs each pixel's variance, so keep the samples
+		Accum accum(setup.width, setup.height);
+		renderer.accum = &accum;
+		renderer.render();
+		renderer.accum = NULL;
+		double t0 = wall_time();
+		ret = write_denoised(&accum, aov, &dp, n_threads, out_name, &post, tile_size, &denoise_seconds);
+		out_seconds = wall_time() - t0;
+	} else {
+		//tiles go to disk as they finish
+		ImageFile image;
+		image.post = post;
+		if (image.open(out_name, setup.width, setup.height, tile_size) < 0) {
+			scene.cleanup();
+			return -1;
+		}
+		renderer.output = &image;
+		renderer.render();
+		renderer.output = NULL;
+		double t0 = wall_time();
+		ret = image.close();
+		out_seconds = wall_time() - t0;
+	}
+	if (aov_name && ret == 0) ret = aov->write(aov_name);
+	delete aov;
+	printf("Traced %ld rays in %.2f s (%.2f Mrays/s, %s, %s)\n", renderer.rays, renderer.seconds,
+		renderer.rays / renderer.seconds * 1e-6, mode == TRACE_PACKET ? "packet" : "scalar", sampler_name(sampling));
+	if (renderer.paths > 0) {
+		printf("Average path length %.2f of at most %d bounces\n", (double)renderer.segments / renderer.paths, max_depth);
 	}
 
-	output.write((char*)"out.bmp");
+	if (bench_name) {
+		BenchRun b;
+		b.scene = fname;
+		b.width = setup.width; b.height = setup.height;
+		b.spp = pass_samples > 0 ? n_samples : renderer.n_samples;
+		b.threads = n_threads;
+		b.mode = mode;
+		b.sampling = sampling;
+		b.seed = seed;
+		b.rays = renderer.rays;
+		b.load = setup.load_seconds; b.textures = setup.texture_seconds;
+		b.bvh = bvh_seconds;
+		b.render = renderer.seconds;
+		b.split = renderer.timing;
+		b.primary = renderer.primary_seconds; b.gi = renderer.gi_seconds; b.shading = renderer.shade_seconds;
+		b.write = renderer.write_seconds + out_seconds - denoise_seconds;
+		b.denoise = denoise_seconds;
+		b.total = wall_time() - start;
+		if (write_bench(bench_name, &b) < 0) ret = -1;
+	}
 
+	free_setup(&setup);
 	scene.cleanup();
+	return ret;
 }
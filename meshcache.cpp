@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "meshcache.h"
+
+inline uint64_t align64(uint64_t x) {return (x + 63) & ~(uint64_t)63;}
+
+MeshCache::MeshCache() {
+	header = NULL;
+	base = NULL;
+	vertices = NULL;
+	triangles = NULL;
+	size = 0;
+}
+
+MeshCache::~MeshCache() {
+	close();
+}
+
+int MeshCache::open(char * fname) {
+	int fd = ::open(fname, O_RDONLY);
+	if (fd < 0) return -1;
+	struct stat sb;
+	if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(MeshCacheHeader)) {
+		::close(fd);
+		return -1;
+	}
+	size = sb.st_size;
+	void * p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) return -1;
+	base = p;
+	header = (const MeshCacheHeader *)p;
+
+	const MeshCacheHeader * h = header;
+	uint64_t vbytes = (uint64_t)h->num_vertices * sizeof(Vertex) + 4;
+	uint64_t ibytes = (uint64_t)h->num_triangles * sizeof(Triangle);
+	if (memcmp(h->magic, MESH_CACHE_MAGIC, 4) != 0 || h->version != MESH_CACHE_VERSION
+			|| h->file_size != size || h->vertex_offs + vbytes > size || h->index_offs + ibytes > size) {
+		printf("%s is not a valid mesh cache\n", fname);
+		close();
+		return -1;
+	}
+	vertices = (const Vertex *)((const char *)base + h->vertex_offs);
+	triangles = (const Triangle *)((const char *)base + h->index_offs);
+
+	//Embree trusts the indices, so a stale or damaged file is caught here
+	bool bad = h->num_triangles == 0;
+	for (uint32_t i = 0; i < h->num_triangles && !bad; i++) {
+		const Triangle * t = &triangles[i];
+		bad = (uint32_t)t->v0 >= h->num_vertices || (uint32_t)t->v1 >= h->num_vertices || (uint32_t)t->v2 >= h->num_vertices;
+	}
+	if (bad) {
+		printf("%s has bad indices\n", fname);
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+void MeshCache::close() {
+	if (base) munmap((void *)base, size);
+	header = NULL;
+	base = NULL;
+	vertices = NULL;
+	triangles = NULL;
+	size = 0;
+}
+
+int write_mesh_cache(char * fname, const Vertex * vertices, int nv, const Triangle * triangles, int nt) {
+	MeshCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MESH_CACHE_MAGIC, 4);
+	h.version = MESH_CACHE_VERSION;
+	h.num_vertices = nv;
+	h.num_triangles = nt;
+	h.vertex_offs = align64(sizeof(h));
+	h.index_offs = align64(h.vertex_offs + (uint64_t)nv * sizeof(Vertex) + 16);
+	h.file_size = h.index_offs + (uint64_t)nt * sizeof(Triangle);
+
+	//write beside the target and rename, so a reader never maps half a
+	//file. mkstemp gives every writer its own file, as meshes of one
+	//scene may cache the same OBJ on several threads at once
+	size_t len = strlen(fname) + 16;
+	char * tmp = (char *)malloc(len);
+	if (!tmp) return -1;
+	snprintf(tmp, len, "%s.XXXXXX", fname);
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(tmp);
+		return -1;
+	}
+	//mkstemp makes it private; a cache is as readable as the OBJ
+	fchmod(fd, 0644);
+	FILE * f = fdopen(fd, "wb");
+	if (!f) {
+		::close(fd);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	static const char zeros[64] = {0};
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	ok = ok && fwrite(zeros, 1, h.vertex_offs - sizeof(h), f) == h.vertex_offs - sizeof(h);
+	ok = ok && fwrite(vertices, sizeof(Vertex), nv, f) == (size_t)nv;
+	uint64_t pad = h.index_offs - h.vertex_offs - (uint64_t)nv * sizeof(Vertex);
+	ok = ok && fwrite(zeros, 1, pad, f) == pad;
+	ok = ok && fwrite(triangles, sizeof(Triangle), nt, f) == (size_t)nt;
+	ok = fclose(f) == 0 && ok;
+
+	if (!ok || rename(tmp, fname) != 0) {
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+	return 0;
+}
+
+bool is_mesh_cache(char * fname) {
+	size_t n = strlen(fname), e = strlen(MESH_CACHE_EXT);
+	return n > e && strcmp(fname + n - e, MESH_CACHE_EXT) == 0;
+}
+
+void mesh_cache_name(char * fname, char * out, size_t len) {
+	snprintf(out, len, "%s%s", fname, MESH_CACHE_EXT);
+}
+
+bool mesh_cache_fresh(char * obj, char * cache) {
+	struct stat so, sc;
+	if (stat(obj, &so) < 0 || stat(cache, &sc) < 0) return false;
+	if (sc.st_mtim.tv_sec != so.st_mtim.tv_sec) return sc.st_mtim.tv_sec > so.st_mtim.tv_sec;
+	return sc.st_mtim.tv_nsec >= so.st_mtim.tv_nsec;
+}
@@ -0,0 +1,59 @@
+#ifndef __MESHCACHE_H
+#define __MESHCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "geom.h"
+
+#define MESH_CACHE_MAGIC "RTMC"
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_EXT ".rtm"
+
+enum {
+	MESH_HAS_NORMALS = 1 << 0,
+	MESH_HAS_UVS = 1 << 1,
+};
+
+//on-disk layout: this header, then 64 byte aligned blocks of
+//float3 vertices (padded for Embree's 16 byte loads), uint3 indices
+//and optionally float3 normals and float2 uvs; offsets are from the
+//start of the file and are 0 for missing blocks
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t num_vertices, num_triangles;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t vertex_offs, index_offs;
+	uint64_t normal_offs, uv_offs;
+	uint64_t file_size;
+} MeshCacheHeader;
+
+//read-only mapping of a cache file; the blocks point into the page
+//cache, so they can be handed to Embree without a copy
+class MeshCache {
+public:
+	MeshCache();
+	~MeshCache();
+public:
+	int open(char * fname);
+	void close();
+public:
+	const MeshCacheHeader * header;
+	const void * base;
+	const Vertex * vertices;
+	const Triangle * triangles;
+	size_t size;
+};
+
+int write_mesh_cache(char * fname, const Vertex * vertices, int nv, const Triangle * triangles, int nt);
+
+//true if fname ends in the cache extension
+bool is_mesh_cache(char * fname);
+
+//the cache file that goes with an OBJ, and whether it is up to date
+void mesh_cache_name(char * fname, char * out, size_t len);
+bool mesh_cache_fresh(char * obj, char * cache);
+
+#endif
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+//writes a bumpy torus of about n triangles as an OBJ, for benchmarks
+//that need meshes bigger than the teapot. it lies on y = 0 around the
+//origin, about the teapot's size, so the default camera frames it
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		printf("Usage: meshgen TRIANGLES out.obj\n");
+		return -1;
+	}
+	long n = atol(argv[1]);
+	if (n < 8) n = 8;
+	//2 * rings * segments triangles, with four segments per ring
+	int rings = (int)ceil(sqrt(n / 8.0));
+	int segs = 4 * rings;
+
+	FILE * f = fopen(argv[2], "w");
+	if (!f) {
+		printf("Could not open %s\n", argv[2]);
+		return -1;
+	}
+	const float major = 2.2f, minor = 0.8f;
+	for (int j = 0; j < segs; j++) {
+		float a = 2.f * (float)M_PI * j / segs;
+		for (int i = 0; i < rings; i++) {
+			float b = 2.f * (float)M_PI * i / rings;
+			float r = minor * (1.f + 0.06f * sinf(7.f * a) * sinf(5.f * b));
+			float d = major + r * cosf(b);
+			fprintf(f, "v %f %f %f\n", d * cosf(a), minor + r * sinf(b), d * sinf(a));
+		}
+	}
+	for (int j = 0; j < segs; j++) {
+		int j1 = (j + 1) % segs;
+		for (int i = 0; i < rings; i++) {
+			int i1 = (i + 1) % rings;
+			int v00 = j * rings + i + 1, v01 = j * rings + i1 + 1;
+			int v10 = j1 * rings + i + 1, v11 = j1 * rings + i1 + 1;
+			fprintf(f, "f %d %d %d\n", v00, v10, v11);
+			fprintf(f, "f %d %d %d\n", v00, v11, v01);
+		}
+	}
+	if (fclose(f) != 0) {
+		printf("Could not write %s\n", argv[2]);
+		return -1;
+	}
+	printf("Wrote %s with %d vertices and %d faces\n", argv[2], rings * segs, 2 * rings * segs);
+	return 0;
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "obj.h"
+
+enum {
+	OBJ_COUNT, //workers count, then wait
+	OBJ_PARSE, //the buffers are in place
+	OBJ_QUIT,  //closed without parsing
+};
+
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+inline bool is_space(char c) {return c == ' ' || c == '\t' || c == '\r';}
+inline bool is_digit(char c) {return c >= '0' && c <= '9';}
+
+inline const char * skip_space(const char * p, const char * end) {
+	while (p < end && is_space(*p)) p++;
+	return p;
+}
+
+inline const char * next_line(const char * p, const char * end) {
+	while (p < end && *p != '\n') p++;
+	return p < end ? p + 1 : end;
+}
+
+//decimal float with optional sign, fraction and exponent
+static const char * parse_float(const char * p, const char * end, float * out) {
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {neg = *p == '-'; p++;}
+
+	unsigned long long mant = 0;
+	int digits = 0, exp = 0;
+	while (p < end && is_digit(*p)) {
+		if (digits < 19) {mant = mant * 10 + (*p - '0'); digits++;}
+		else exp++;
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && is_digit(*p)) {
+			if (digits < 19) {mant = mant * 10 + (*p - '0'); digits++; exp--;}
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool eneg = false;
+		if (p < end && (*p == '-' || *p == '+')) {eneg = *p == '-'; p++;}
+		int e = 0;
+		while (p < end && is_digit(*p)) {if (e < 1000) e = e * 10 + (*p - '0'); p++;}
+		exp += eneg ? -e : e;
+	}
+
+	double x = (double)mant;
+	while (exp > 22) {x *= 1e22; exp -= 22;}
+	while (exp < -22) {x /= 1e22; exp += 22;}
+	x = exp >= 0 ? x * pow10_table[exp] : x / pow10_table[-exp];
+	*out = (float)(neg ? -x : x);
+	return p;
+}
+
+static const char * parse_int(const char * p, const char * end, int * out) {
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {neg = *p == '-'; p++;}
+	int x = 0;
+	while (p < end && is_digit(*p)) {x = x * 10 + (*p - '0'); p++;}
+	*out = neg ? -x : x;
+	return p;
+}
+
+//number of corners on an 'f' line, p just past the 'f'
+static int count_corners(const char * p, const char * end) {
+	int n = 0;
+	for (;;) {
+		p = skip_space(p, end);
+		if (p >= end || *p == '\n' || *p == '#') return n;
+		n++;
+		while (p < end && !is_space(*p) && *p != '\n') p++;
+	}
+}
+
+ObjFile::ObjFile() {
+	data = NULL;
+	chunks = NULL;
+	n_chunks = 0;
+	pool = NULL;
+	n_workers = 0;
+	counting = 0;
+	pass = OBJ_COUNT;
+	out_vertices = NULL;
+	out_triangles = NULL;
+	size = 0;
+	num_vertices = 0;
+	num_triangles = 0;
+}
+
+ObjFile::~ObjFile() {
+	close();
+}
+
+int ObjFile::open(char * fname, int n_threads) {
+	int fd = ::open(fname, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) < 0 || sb.st_size == 0) {
+		printf("Could not read %s\n", fname);
+		::close(fd);
+		return -1;
+	}
+	size = sb.st_size;
+	data = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		printf("Could not map %s\n", fname);
+		data = NULL;
+		return -1;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	//aim for a few MB per chunk, but no more chunks than are useful
+	if (n_threads < 1) n_threads = 1;
+	n_chunks = (int)(size >> 22) + 1;
+	if (n_chunks > 4 * n_threads) n_chunks = 4 * n_threads;
+
+	const char * end = data + size;
+	chunks = (ObjChunk *)calloc(n_chunks, sizeof(ObjChunk));
+	if (!chunks) {
+		printf("Out of memory reading %s\n", fname);
+		close();
+		return -1;
+	}
+	for (int i = 0; i < n_chunks; i++) {
+		const char * b = data + size * i / n_chunks;
+		if (i > 0) b = next_line(b - 1, end);
+		chunks[i].begin = b;
+		if (i > 0) chunks[i - 1].end = b;
+	}
+	chunks[n_chunks - 1].end = end;
+
+	//pass 1: count, so the buffers can be sized exactly
+	n_workers = n_threads < n_chunks ? n_threads : n_chunks;
+	next_count = 0;
+	next_parse = 0;
+	counting = n_workers;
+	pass = OBJ_COUNT;
+	pool = new std::thread[n_workers];
+	for (int i = 0; i < n_workers; i++) {
+		pool[i] = std::thread(&ObjFile::worker, this);
+	}
+	{
+		std::unique_lock<std::mutex> hold(lock);
+		wake.wait(hold, [this] {return counting == 0;});
+	}
+
+	num_vertices = 0;
+	num_triangles = 0;
+	for (int i = 0; i < n_chunks; i++) {
+		chunks[i].v_offs = num_vertices;
+		chunks[i].t_offs = num_triangles;
+		num_vertices += chunks[i].nv;
+		num_triangles += chunks[i].nt;
+	}
+	return 0;
+}
+
+int ObjFile::parse(Vertex * vertices, Triangle * triangles) {
+	//pass 2: each chunk knows where its output starts
+	lock.lock();
+	out_vertices = vertices;
+	out_triangles = triangles;
+	pass = OBJ_PARSE;
+	lock.unlock();
+	wake.notify_all();
+	stop_workers();
+
+	int bad = 0;
+	for (int i = 0; i < n_chunks; i++) bad += chunks[i].bad;
+	if (bad > 0) {
+		printf("%d face indices out of range\n", bad);
+		return -1;
+	}
+	return 0;
+}
+
+//takes chunks until none are left, for both passes
+void ObjFile::worker() {
+	for (int i = next_count++; i < n_chunks; i = next_count++) count_chunk(&chunks[i]);
+	std::unique_lock<std::mutex> hold(lock);
+	if (--counting == 0) wake.notify_all();
+	wake.wait(hold, [this] {return pass != OBJ_COUNT;});
+	if (pass == OBJ_QUIT) return;
+	hold.unlock();
+	for (int i = next_parse++; i < n_chunks; i = next_parse++) parse_chunk(&chunks[i], out_vertices, out_triangles);
+}
+
+//joins the workers, letting them go unparsed if parse() never came
+void ObjFile::stop_workers() {
+	if (!pool) return;
+	lock.lock();
+	if (pass == OBJ_COUNT) pass = OBJ_QUIT;
+	lock.unlock();
+	wake.notify_all();
+	for (int i = 0; i < n_workers; i++) pool[i].join();
+	delete[] pool;
+	pool = NULL;
+	n_workers = 0;
+}
+
+void ObjFile::close() {
+	stop_workers();
+	if (data) munmap(data, size);
+	free(chunks);
+	data = NULL;
+	chunks = NULL;
+	n_chunks = 0;
+}
+
+void ObjFile::count_chunk(ObjChunk * c) {
+	const char * p = c->begin;
+	const char * end = c->end;
+	c->nv = 0; c->nt = 0;
+	while (p < end) {
+		p = skip_space(p, end);
+		if (end - p > 1 && p[0] == 'v' && is_space(p[1])) {
+			c->nv++;
+		} else if (end - p > 1 && p[0] == 'f' && is_space(p[1])) {
+			int n = count_corners(p + 1, end);
+			if (n >= 3) c->nt += n - 2;
+		}
+		p = next_line(p, end);
+	}
+}
+
+void ObjFile::parse_chunk(ObjChunk * c, Vertex * vertices, Triangle * triangles) {
+	const char * p = c->begin;
+	const char * end = c->end;
+	int nv = c->v_offs, nt = c->t_offs;
+	c->bad = 0;
+
+	while (p < end) {
+		p = skip_space(p, end);
+		if (end - p > 1 && p[0] == 'v' && is_space(p[1])) {
+			Vertex * v = &vertices[nv++];
+			p = parse_float(skip_space(p + 1, end), end, &v->x);
+			p = parse_float(skip_space(p, end), end, &v->y);
+			p = parse_float(skip_space(p, end), end, &v->z);
+		} else if (end - p > 1 && p[0] == 'f' && is_space(p[1])) {
+			//v, v/vt, v//vn or v/vt/vn; only the position index is used
+			//negative indices count back from the last vertex so far
+			int first = 0, prev = 0, n = 0;
+			p++;
+			for (;;) {
+				p = skip_space(p, end);
+				if (p >= end || *p == '\n' || *p == '#') break;
+				int k;
+				p = parse_int(p, end, &k);
+				k = k < 0 ? nv + k : k - 1;
+				if (k < 0 || k >= num_vertices) {c->bad++; k = 0;}
+				while (p < end && !is_space(*p) && *p != '\n') p++;
+
+				//fan triangulation for n-gons
+				if (n == 0) first = k;
+				else if (n >= 2) {
+					Triangle * t = &triangles[nt++];
+					t->v0 = first; t->v1 = prev; t->v2 = k;
+				}
+				prev = k;
+				n++;
+			}
+		}
+		p = next_line(p, end);
+	}
+}
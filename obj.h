@@ -0,0 +1,57 @@
+#ifndef __OBJ_H
+#define __OBJ_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "geom.h"
+
+typedef struct {
+	const char *begin, *end;
+	int nv, nt;         //vertices and triangles in this chunk
+	int v_offs, t_offs; //where they go in the output
+	int bad;            //out of range face indices
+} ObjChunk;
+
+//memory-mapped OBJ reader; the file is split into line-aligned chunks
+//that are counted and then parsed in parallel, straight into the
+//caller's vertex and index buffers. the same workers do both passes:
+//open() starts them and returns once they have counted, and they wait
+//there for parse() to hand them the buffers
+class ObjFile {
+public:
+	ObjFile();
+	~ObjFile();
+public:
+	int open(char * fname, int n_threads);
+	int parse(Vertex * vertices, Triangle * triangles);
+	void close();
+public:
+	int num_vertices, num_triangles;
+	size_t size;
+private:
+	void count_chunk(ObjChunk * c);
+	void parse_chunk(ObjChunk * c, Vertex * vertices, Triangle * triangles);
+	void worker();
+	void stop_workers();
+private:
+	char * data;
+	ObjChunk * chunks;
+	int n_chunks;
+	std::thread * pool;
+	int n_workers;
+	//the next chunk to count and to parse
+	std::atomic<int> next_count, next_parse;
+	std::mutex lock;
+	std::condition_variable wake;
+	//workers still counting; the pass the workers were let into
+	int counting;
+	int pass;
+	Vertex * out_vertices;
+	Triangle * out_triangles;
+};
+
+#endif
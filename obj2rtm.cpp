@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+#include "obj.h"
+#include "meshcache.h"
+
+//converts OBJ files to .rtm mesh caches that embree_test can map directly
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 3) {
+		printf("Usage: obj2rtm file.obj [out.rtm]\n");
+		return -1;
+	}
+
+	char cname[4096];
+	if (argc > 2) snprintf(cname, sizeof(cname), "%s", argv[2]);
+	else mesh_cache_name(argv[1], cname, sizeof(cname));
+
+	ObjFile obj;
+	if (obj.open(argv[1], std::thread::hardware_concurrency()) < 0) return -1;
+
+	Vertex * vertices = (Vertex *)malloc(obj.num_vertices * sizeof(Vertex));
+	Triangle * triangles = (Triangle *)malloc(obj.num_triangles * sizeof(Triangle));
+	if (obj.parse(vertices, triangles) < 0) return -1;
+
+	if (write_mesh_cache(cname, vertices, obj.num_vertices, triangles, obj.num_triangles) < 0) {
+		printf("Could not write %s\n", cname);
+		return -1;
+	}
+	printf("Wrote %s with %d vertices and %d faces\n", cname, obj.num_vertices, obj.num_triangles);
+
+	free(vertices);
+	free(triangles);
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "geom.h"
+#include "post.h"
+
+//pixels per block; each stage is a plain loop over the block's
+//channel arrays, which the compiler turns into SIMD
+#define POST_BLOCK 64
+
+typedef vec3fN<POST_BLOCK> PostBlock;
+
+void post_init(PostParams * p) {
+	p->exposure = 0.f;
+	p->tone = TONE_CLAMP;
+	p->srgb = false;
+	p->dither = false;
+}
+
+int post_set_tone(PostParams * p, char * name) {
+	if (!strcmp(name, "clamp")) p->tone = TONE_CLAMP;
+	else if (!strcmp(name, "aces")) p->tone = TONE_ACES;
+	else if (!strcmp(name, "filmic")) p->tone = TONE_FILMIC;
+	else return -1;
+	p->srgb = p->dither = p->tone != TONE_CLAMP;
+	return 0;
+}
+
+//branch-free helpers so the loops below vectorise
+inline float clamp01(float x) {
+	x = x < 0.f ? 0.f : x;
+	return x > 1.f ? 1.f : x;
+}
+
+inline float aces(float x) {
+	return clamp01(x * (2.51f * x + 0.03f) / (x * (2.43f * x + 0.59f) + 0.14f));
+}
+
+inline float hable(float x) {
+	const float a = 0.15f, b = 0.50f, c = 0.10f, d = 0.20f, e = 0.02f, f = 0.30f;
+	return (x * (a * x + c * b) + d * e) / (x * (a * x + b) + d * f) - e / f;
+}
+
+//Ian Taylor's fit of the sRGB power segment, in square roots only
+inline float srgb(float x) {
+	float s1 = sqrtf(x), s2 = sqrtf(s1), s3 = sqrtf(s2);
+	float g = 0.585122381f * s1 + 0.783140355f * s2 - 0.368262736f * s3;
+	return x <= 0.0031308f ? 12.92f * x : g;
+}
+
+//uniform in [0, 1) from a pixel position
+inline float dither(uint32_t x, uint32_t y, uint32_t c) {
+	uint32_t h = x * 0x9e3779b1u ^ y * 0x85ebca77u ^ c * 0xc2b2ae3du;
+	h ^= h >> 15; h *= 0x2c1b3c6du;
+	h ^= h >> 12; h *= 0x297a2d39u;
+	h ^= h >> 15;
+	return (float)(h >> 8) * (1.f / 16777216.f);
+}
+
+static void tone_channel(const PostParams * p, float * c, int n) {
+	if (p->tone == TONE_ACES) {
+		for (int i = 0; i < n; i++) c[i] = aces(c[i]);
+	} else if (p->tone == TONE_FILMIC) {
+		const float white = 1.f / hable(11.2f);
+		for (int i = 0; i < n; i++) c[i] = clamp01(hable(2.f * c[i]) * white);
+	} else {
+		for (int i = 0; i < n; i++) c[i] = clamp01(c[i]);
+	}
+	if (p->srgb) {
+		for (int i = 0; i < n; i++) c[i] = srgb(c[i]);
+	}
+}
+
+void post_span(const PostParams * p, const float * rgb, unsigned char * out, int n, int x, int y) {
+	PostBlock b;
+	float k = exp2f(p->exposure);
+	for (int a = 0; a < n; a += POST_BLOCK) {
+		int m = n - a < POST_BLOCK ? n - a : POST_BLOCK;
+		const float * src = rgb + 3 * a;
+		for (int i = 0; i < m; i++) {
+			b.x[i] = src[3 * i] * k; b.y[i] = src[3 * i + 1] * k; b.z[i] = src[3 * i + 2] * k;
+		}
+		tone_channel(p, b.x, m);
+		tone_channel(p, b.y, m);
+		tone_channel(p, b.z, m);
+
+		//the old output truncated; dithering rounds with noise instead
+		float * ch[3] = {b.x, b.y, b.z};
+		unsigned char * dst = out + 3 * a;
+		for (int c = 0; c < 3; c++) {
+			float * v = ch[c];
+			if (p->dither) {
+				for (int i = 0; i < m; i++) v[i] = v[i] * 255.f + dither(x + a + i, y, c);
+			} else {
+				for (int i = 0; i < m; i++) v[i] = v[i] * 255.f;
+			}
+			for (int i = 0; i < m; i++) {
+				float q = v[i] > 255.f ? 255.f : v[i];
+				dst[3 * i + c] = (unsigned char)(int)q;
+			}
+		}
+	}
+}
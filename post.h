@@ -0,0 +1,29 @@
+#ifndef __POST_H
+#define __POST_H
+
+enum {
+	TONE_CLAMP,  //clip at 1, the old 8-bit output
+	TONE_ACES,   //Narkowicz's fit of the ACES filmic curve
+	TONE_FILMIC, //Hable's Uncharted 2 curve
+};
+
+//turns linear radiance into display bytes: exposure, tone curve,
+//sRGB encoding and dithering, in that order
+typedef struct {
+	float exposure; //in stops
+	int tone;
+	bool srgb;
+	bool dither;
+} PostParams;
+
+//the legacy look: no exposure, clamp, no sRGB, truncate
+void post_init(PostParams * p);
+//tone curves other than clamp are meant for display, so they turn on
+//sRGB and dithering
+int post_set_tone(PostParams * p, char * name);
+
+//n pixels of interleaved RGB starting at (x, y) to RGB bytes; x and y
+//only seed the dither, so the same pixel always gets the same noise
+void post_span(const PostParams * p, const float * rgb, unsigned char * out, int n, int x, int y);
+
+#endif
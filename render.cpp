@@ -0,0 +1,807 @@
+#include <embree3/rtcore.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <thread>
+
+#include "geom.h"
+#include "render.h"
+#include "stats.h"
+
+inline void setRayDir(RTCRayHit * rh, const vec3f & dir) {
+	rh->ray.dir_x = dir.x;
+	rh->ray.dir_y = dir.y;
+	rh->ray.dir_z = dir.z;
+}
+
+inline void setRayOrg(RTCRayHit * rh, const vec3f & org) {
+	rh->ray.org_x = org.x;
+	rh->ray.org_y = org.y;
+	rh->ray.org_z = org.z;
+}
+
+inline vec3f local_u(const vec3f & hit_n) {
+	vec3f hit_u(-hit_n.y, hit_n.x, 0.f);
+	if (hit_u.abs() == 0.f) {
+		hit_u = vec3f(0.f, -hit_n.z, hit_n.y);
+	}
+	hit_u.normalize();
+	return hit_u;
+}
+
+//sampler direction for a bounce around n, on the side the ray came from
+inline vec3f sample_dir(const vec3f & n, float backside, int bounce, const Sampler * s, float * w) {
+	vec3f u = local_u(n);
+	vec3f v = n.cross(u);
+
+	vec3f d = s->hemisphere(bounce, w);
+	vec3f out_dir = u * d.x + v * d.y + n * (d.z * backside);
+	out_dir.normalize();
+
+	return out_dir;
+}
+
+//the shading frame of bsdf_*: around n, turned to the side backside
+//says the path arrived from
+typedef struct {
+	vec3f u, v, z;
+} Frame;
+
+inline Frame shading_frame(const vec3f & n, float backside) {
+	Frame f;
+	f.u = local_u(n);
+	f.v = n.cross(f.u);
+	f.z = n * backside;
+	return f;
+}
+
+inline vec3f to_local(const Frame & f, const vec3f & d) {
+	return vec3f(d.dot(f.u), d.dot(f.v), d.dot(f.z));
+}
+
+//bounce direction for a path arriving along in_dir at a surface of
+//material m with normal n. *w is f cos / pdf per unit albedo and *pdf
+//the solid angle density, 0 for a delta lobe; false if the path is
+//absorbed. lambert surfaces keep the sampler's hemisphere, so -S still
+//picks how they are sampled
+inline bool sample_bounce(const Material * m, const vec3f & n, float backside, const vec3f & in_dir, int b,
+		const Sampler * s, vec3f * out, float * w, float * pdf) {
+	if (m->kind == MAT_LAMBERT) {
+		*out = sample_dir(n, backside, b, s, w);
+		*pdf = s->pdf(backside * n.dot(*out));
+		return true;
+	}
+	STAT_INC(STAT_BSDF_SAMPLES);
+	STAT_TIMER(TIMER_BSDF);
+	Frame f = shading_frame(n, backside);
+	//leaving glass, the index beyond is the outside's
+	Material mm = *m;
+	if (backside < 0.f) mm.ior = 1.f / mm.ior;
+	float u1, u2;
+	s->direction2(b, &u1, &u2);
+	vec3f wi;
+	if (!bsdf_sample(&mm, to_local(f, -in_dir.normalized()), u1, u2, s->lobe(b), &wi, w, pdf)) return false;
+	*out = (f.u * wi.x + f.v * wi.y + f.z * wi.z).normalized();
+	return true;
+}
+
+//brdf value of m towards dir and the density sample_bounce picks it
+//with; n is turned to the side in_dir came from
+inline float eval_bounce(const Material * m, const vec3f & n, const vec3f & in_dir, const vec3f & dir,
+		const Sampler * s, float * pdf) {
+	if (m->kind == MAT_LAMBERT) {
+		*pdf = s->pdf(n.dot(dir));
+		return 1.f / (float)M_PI;
+	}
+	STAT_TIMER(TIMER_BSDF);
+	Frame f = shading_frame(n, 1.f);
+	vec3f wo = to_local(f, -in_dir.normalized()), wi = to_local(f, dir);
+	*pdf = bsdf_pdf(m, wo, wi);
+	return bsdf_eval(m, wo, wi);
+}
+
+#define PACKET_SIZE 8
+
+//paths this long or longer may end by russian roulette
+#define RR_DEPTH 2
+
+//widest angular spread given to a GI ray, in radians
+#define GI_MAX_SPREAD 0.02f
+
+//angular spread of a GI ray, the solid angle 1 / pdf its lobe gives
+//it; only glossy lobes come in under the cap, so diffuse bounces stay
+//close to a sharp lookup
+inline float segment_angle(float pdf) {
+	return pdf > 0.f ? fminf(sqrtf(1.f / pdf), GI_MAX_SPREAD) : 0.f;
+}
+
+//footprint of a GI segment of length t, for filtering the albedo it
+//hits; emission is looked up sharp, as the light samples it is
+//weighed against are
+inline float segment_width(float t, float pdf) {
+	return t * segment_angle(pdf);
+}
+
+//probability of carrying on with throughput thr into albedo f
+inline float survival(const vec3f & thr, const vec3f & f) {
+	vec3f t = thr * f;
+	return fminf(fmaxf(t.x, fmaxf(t.y, t.z)), 0.95f);
+}
+
+//copy one lane of a packet result into a single ray/hit
+inline void packet_lane(RTCRayHit8 * p, int i, RTCRayHit * rh) {
+	rh->ray.org_x = p->ray.org_x[i]; rh->ray.org_y = p->ray.org_y[i]; rh->ray.org_z = p->ray.org_z[i];
+	rh->ray.dir_x = p->ray.dir_x[i]; rh->ray.dir_y = p->ray.dir_y[i]; rh->ray.dir_z = p->ray.dir_z[i];
+	rh->ray.tnear = p->ray.tnear[i]; rh->ray.tfar = p->ray.tfar[i];
+	rh->hit.Ng_x = p->hit.Ng_x[i]; rh->hit.Ng_y = p->hit.Ng_y[i]; rh->hit.Ng_z = p->hit.Ng_z[i];
+	rh->hit.u = p->hit.u[i]; rh->hit.v = p->hit.v[i];
+	rh->hit.primID = p->hit.primID[i]; rh->hit.geomID = p->hit.geomID[i];
+	rh->hit.instID[0] = p->hit.instID[0][i];
+}
+
+RTRenderer::RTRenderer(RTScene * s, int w, int h) {
+	scene = s;
+	width = w;
+	height = h;
+	output = NULL;
+	n_samples = 16;
+	n_threads = 1;
+	tile_size = 16;
+	mode = TRACE_SCALAR;
+	sampling = SAMPLE_SOBOL;
+	seed = 0;
+	lights = NULL;
+	max_depth = 4;
+	accum = NULL;
+	features = NULL;
+	threshold = 0.f;
+	min_spp = 0;
+	timing = false;
+	part = 0;
+	parts = 1;
+	sample_offset = 0;
+	x0 = y0 = 0;
+	rays = 0;
+	paths = 0;
+	segments = 0;
+	seconds = 0.0;
+	primary_seconds = gi_seconds = shade_seconds = write_seconds = 0.0;
+}
+
+//the one clock around a stage: it feeds the stage split when the
+//renderer is timing and timer t of the stats report in instrumented
+//builds, and costs a branch otherwise
+class StageTimer {
+public:
+	StageTimer(bool timing, int t, uint64_t * total) : timer(t), sum(timing ? total : NULL) {
+		start = sum || STATS_ON ? stats_ticks() : 0;
+	}
+	~StageTimer() {
+		if (!sum && !STATS_ON) return;
+		uint64_t d = stats_ticks() - start;
+		if (sum) *sum += d;
+		STAT_TIME(timer, d);
+	}
+private:
+	int timer;
+	uint64_t * sum;
+	uint64_t start;
+};
+
+void RTRenderer::render() {
+	if (n_threads < 1) n_threads = 1;
+	TileQueue q(width, height, tile_size, n_threads, part, parts);
+	rays = 0;
+	paths = 0;
+	segments = 0;
+	primary_seconds = gi_seconds = shade_seconds = write_seconds = 0.0;
+	double start = wall_time();
+
+	std::thread * pool = new std::thread[n_threads];
+	for (int i = 0; i < n_threads; i++) {
+		pool[i] = std::thread(&RTRenderer::worker, this, &q, i);
+	}
+	for (int i = 0; i < n_threads; i++) {
+		pool[i].join();
+	}
+	delete[] pool;
+	seconds = wall_time() - start;
+	primary_seconds /= n_threads;
+	gi_seconds /= n_threads;
+	shade_seconds /= n_threads;
+	write_seconds /= n_threads;
+}
+
+void RTRenderer::worker(TileQueue * q, int id) {
+	RTRayState st;
+	rtcInitIntersectContext(&st.context);
+	rtcInitIntersectContext(&st.coherent);
+	st.coherent.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+	st.rays = 0;
+	st.paths = 0;
+	st.segments = 0;
+	st.primary_ticks = st.gi_ticks = st.write_ticks = st.tile_ticks = 0;
+
+	int cap = PACKET_SIZE * (n_samples > 0 ? n_samples : 1);
+	st.stream = (RTCRayHit *)aligned_alloc(16, cap * sizeof(RTCRayHit));
+	st.owner = (int *)malloc(cap * sizeof(int));
+	st.bsdf_pdf = (float *)malloc(cap * sizeof(float));
+	st.shadows = (RTCRay *)aligned_alloc(16, cap * sizeof(RTCRay));
+	st.shadow_owner = (int *)malloc(cap * sizeof(int));
+	alloc_batch(&st.primary, PACKET_SIZE);
+	alloc_batch(&st.bounce, cap);
+	alloc_colors(&st.albedo, PACKET_SIZE);
+	alloc_colors(&st.direct, PACKET_SIZE);
+	alloc_colors(&st.incoming, cap);
+	alloc_colors(&st.hit_albedo, cap);
+	alloc_colors(&st.throughput, cap);
+	alloc_colors(&st.unshadowed, cap);
+	alloc_colors(&st.samples, cap);
+	st.pixels = (float *)malloc(3 * tile_size * tile_size * sizeof(float));
+
+	Tile t;
+	st.tile = &t;
+	while (q->next(id, &t)) {
+		STAT_INC(STAT_TILES);
+		{
+			StageTimer clock(timing, TIMER_TILE, &st.tile_ticks);
+			if (mode == TRACE_PACKET) {
+				render_tile_packet(&t, &st);
+			} else {
+				render_tile(&t, &st);
+			}
+		}
+		if (!accum && output) {
+			StageTimer clock(timing, TIMER_WRITE, &st.write_ticks);
+			output->write_tile(&t, st.pixels);
+		}
+	}
+
+	free(st.stream);
+	free(st.owner);
+	free(st.bsdf_pdf);
+	free(st.shadows);
+	free(st.shadow_owner);
+	free_batch(&st.primary);
+	free_batch(&st.bounce);
+	free_colors(&st.albedo);
+	free_colors(&st.direct);
+	free_colors(&st.incoming);
+	free_colors(&st.hit_albedo);
+	free_colors(&st.throughput);
+	free_colors(&st.unshadowed);
+	free_colors(&st.samples);
+	free(st.pixels);
+
+	lock.lock();
+	rays += st.rays;
+	paths += st.paths;
+	segments += st.segments;
+	if (timing) {
+		double tick = stats_tick_seconds();
+		primary_seconds += st.primary_ticks * tick;
+		gi_seconds += st.gi_ticks * tick;
+		write_seconds += st.write_ticks * tick;
+		shade_seconds += (double)(st.tile_ticks - st.primary_ticks - st.gi_ticks) * tick;
+	}
+	lock.unlock();
+}
+
+void RTRenderer::render_tile(Tile * t, RTRayState * st) {
+	for (int v = t->y0; v < t->y1; v++) {
+		for (int u = t->x0; u < t->x1; u++) {
+			if (accum && !accum->active(u, v)) continue;
+			render_px(u, v, st);
+		}
+	}
+}
+
+void RTRenderer::render_px(int u, int v, RTRayState * st) {
+	RTCRayHit * rh = &st->rh;
+	st->sampler.start(sampling, seed, pixel_index(u, v), first_sample(u, v));
+
+	scene->resetRH(rh);
+
+	setRayOrg(rh, scene->cam->eye);
+	setRayDir(rh, scene->cam->lookat(u + x0, v + y0));
+
+	{
+		StageTimer clock(timing, TIMER_PRIMARY, &st->primary_ticks);
+		rtcIntersect1(scene->scene, &st->context, rh);
+	}
+	st->rays++;
+	STAT_INC(STAT_PRIMARY_RAYS);
+
+	//fill with background color
+	if (rh->hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+		STAT_INC(STAT_PRIMARY_MISSES);
+		vec3f dir(rh->ray.dir_x, rh->ray.dir_y, rh->ray.dir_z);
+		vec3f bg = scene->environment(dir, scene->cam->spread());
+		if (features) features->set(u, v, bg, vec3f(0.f, 0.f, 0.f), 0.f, -1);
+		store(u, v, bg, vec3f(0.f, 0.f, 0.f), 0.f, st);
+		return;
+	}
+
+	//hit point, normal vector
+	vec3f hit_p = scene->hitP(rh);
+	vec3f hit_n = scene->hitN(rh);
+
+	//store last hit
+	int last_id = hit_id(rh->hit);
+	STAT_HIT(last_id);
+	int last_prim = rh->hit.primID;
+	vec3f last_dir(rh->ray.dir_x, rh->ray.dir_y, rh->ray.dir_z);
+	float width = primary_width(rh);
+	vec3f last_color = scene->color(last_id, last_prim, rh->hit.u, rh->hit.v, width);
+	bool scatters = scene->scatters(last_id, last_prim);
+
+	//direct (just emission for now)
+	vec3f d_illum = scene->emit(last_id, rh->hit.primID, rh->hit.u, rh->hit.v, width);
+	if (features) features->set(u, v, scatters ? last_color : d_illum, hit_n, rh->ray.tfar, last_id);
+
+	//do GI
+	vec3f g_illum(0.f, 0.f, 0.f);
+	float g_sq = 0.f;
+
+	if (!scatters) { //trick to speed up the skybox
+		STAT_INC(STAT_SKY_SHORTCUTS);
+		store(u, v, d_illum, g_illum, g_sq, st);
+		return;
+	}
+
+	Material m = scene->material(last_id, last_prim);
+	for (int sample = 0; sample < n_samples; sample++) {
+		st->sampler.next_sample();
+		vec3f c = trace_path(hit_p, hit_n, last_dir, last_color, m, st);
+		float y = luminance(c);
+		g_illum += c;
+		g_sq += y * y;
+	}
+	//direct + global
+	store(u, v, d_illum, g_illum, g_sq, st);
+}
+
+//follows one path out of the camera hit at p, with normal n, albedo f
+//and material m, and returns the radiance it brings back
+vec3f RTRenderer::trace_path(vec3f p, vec3f n, vec3f in_dir, vec3f f, Material m, RTRayState * st) {
+	RTCRayHit * rh = &st->rh;
+	vec3f c(0.f, 0.f, 0.f);
+	vec3f thr(1.f, 1.f, 1.f);
+	st->paths++;
+
+	for (int b = 0; b < max_depth; b++) {
+		float backside = in_dir.dot(n) > 0.f ? -1.f : 1.f;
+
+		//next event: a point on a light, if nothing is in the way. no
+		//light is ever in a delta lobe's one direction
+		vec3f lc;
+		if (lights && !material_delta(&m) && light_sample(p, n * backside, in_dir, &m, thr * f, b, &st->sampler, &st->shadow, &lc)) {
+			{
+				StageTimer clock(timing, TIMER_SHADOW, &st->gi_ticks);
+				rtcOccluded1(scene->scene, &st->context, &st->shadow);
+			}
+			st->rays++;
+			STAT_INC(STAT_SHADOW_RAYS);
+			if (st->shadow.tfar >= 0.f) c += lc;
+			else STAT_INC(STAT_SHADOWED);
+		}
+
+		vec3f out_dir;
+		float w, pdf_b;
+		if (!sample_bounce(&m, n, backside, in_dir, b, &st->sampler, &out_dir, &w, &pdf_b)) break;
+
+		//next segment
+		scene->resetRH(rh);
+		setRayOrg(rh, p);
+		setRayDir(rh, out_dir);
+
+		{
+			StageTimer clock(timing, TIMER_GI, &st->gi_ticks);
+			rtcIntersect1(scene->scene, &st->context, rh);
+		}
+		st->rays++;
+		st->segments++;
+		STAT_INC(STAT_GI_RAYS);
+
+		//escaping rays see the environment, which the lights don't cover.
+		//it is looked up sharp: any filtering would smear the sun out of
+		//the indirect light
+		thr = thr * f * w;
+		if (rh->hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+			STAT_INC(STAT_GI_MISSES);
+			if (scene->env) c += thr * scene->environment(out_dir, 0.f);
+			break;
+		}
+
+		//add the emission from the new hit
+		int id = hit_id(rh->hit);
+		STAT_HIT(id);
+		vec3f emission = scene->emit(id, rh->hit.primID, rh->hit.u, rh->hit.v, 0.f);
+		c += thr * emission * bsdf_weight(id, rh, pdf_b);
+
+		if (b + 1 == max_depth || !scene->scatters(id, rh->hit.primID)) break;
+		m = scene->material(id, rh->hit.primID);
+		f = scene->color(id, rh->hit.primID, rh->hit.u, rh->hit.v, segment_width(rh->ray.tfar, pdf_b));
+
+		if (b + 1 >= RR_DEPTH) {
+			float q = survival(thr, f);
+			if (st->sampler.roulette(b) >= q) {
+				STAT_INC(STAT_ROULETTE_KILLS);
+				break;
+			}
+			thr = thr * (1.f / q);
+		}
+
+		p = scene->hitP(rh);
+		n = scene->hitN(rh);
+		in_dir = out_dir;
+	}
+	return c;
+}
+
+//camera rays go out as 8-wide packets along a tile row, and
+//their GI rays are traced together as one stream
+void RTRenderer::render_tile_packet(Tile * t, RTRayState * st) {
+	RTCRayHit8 * p = &st->packet;
+	vec3f eye = scene->cam->eye;
+	int valid[PACKET_SIZE];
+
+	for (int v = t->y0; v < t->y1; v++) {
+		for (int u0 = t->x0; u0 < t->x1; u0 += PACKET_SIZE) {
+			int n = t->x1 - u0 < PACKET_SIZE ? t->x1 - u0 : PACKET_SIZE;
+			int live = 0;
+			for (int i = 0; i < PACKET_SIZE; i++) {
+				valid[i] = i < n && (!accum || accum->active(u0 + i, v)) ? -1 : 0;
+				if (valid[i]) live++;
+				vec3f dir = scene->cam->lookat((i < n ? u0 + i : u0) + x0, v + y0);
+				p->ray.org_x[i] = eye.x; p->ray.org_y[i] = eye.y; p->ray.org_z[i] = eye.z;
+				p->ray.dir_x[i] = dir.x; p->ray.dir_y[i] = dir.y; p->ray.dir_z[i] = dir.z;
+				p->ray.tnear[i] = 0.01f; p->ray.tfar[i] = FLT_MAX; p->ray.time[i] = 0.f;
+				p->ray.mask[i] = -1; p->ray.id[i] = i; p->ray.flags[i] = 0;
+				p->hit.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+				p->hit.instID[0][i] = RTC_INVALID_GEOMETRY_ID;
+			}
+
+			if (live == 0) continue;
+
+			{
+				StageTimer clock(timing, TIMER_PRIMARY, &st->primary_ticks);
+				rtcIntersect8(valid, scene->scene, &st->coherent, p);
+			}
+			st->rays += live;
+			STAT_ADD(STAT_PRIMARY_RAYS, live);
+
+			shade_packet(u0, v, n, valid, st);
+		}
+	}
+}
+
+//paths are traced a bounce at a time for the whole packet: every
+//segment goes out in one stream and their hits are shaded in object
+//order. lanes that aren't valid carry no hit and are not stored
+void RTRenderer::shade_packet(int u0, int v, int n, int * valid, RTRayState * st) {
+	RTCRayHit * rh = &st->rh;
+	RTHitBatch * pb = &st->primary;
+	RTHitBatch * gb = &st->bounce;
+	RTColorBatch * sc = &st->samples;
+	RTColorBatch * tp = &st->throughput;
+	Sampler lane[PACKET_SIZE];
+	bool scatters[PACKET_SIZE];
+	int m = 0, ns = 0;
+
+	//shade all primary hits at once; lane i is batch entry i
+	pb->n = 0;
+	for (int i = 0; i < n; i++) {
+		packet_lane(&st->packet, i, rh);
+		add_hit(pb, rh, primary_width(rh));
+	}
+	scene->group(pb);
+	scene->color_batch(pb, &st->albedo);
+	scene->emit_batch(pb, &st->direct);
+	for (int i = 0; i < n; i++) {
+		scatters[i] = pb->geomID[i] != RTC_INVALID_GEOMETRY_ID && scene->scatters(pb->geomID[i], pb->primID[i]);
+	}
+
+	//first segment of every path. each remembers its sample slot,
+	//lane * n_samples + sample, where all its pieces add up
+	for (int i = 0; i < n * n_samples; i++) {
+		sc->r[i] = 0.f; sc->g[i] = 0.f; sc->b[i] = 0.f;
+	}
+	for (int i = 0; i < n; i++) {
+		if (pb->geomID[i] == RTC_INVALID_GEOMETRY_ID) continue;
+		STAT_HIT(pb->geomID[i]);
+		if (!scatters[i]) { //trick to speed up the skybox
+			STAT_INC(STAT_SKY_SHORTCUTS);
+			continue;
+		}
+		lane[i].start(sampling, seed, pixel_index(u0 + i, v), first_sample(u0 + i, v));
+
+		packet_lane(&st->packet, i, rh);
+		vec3f hit_p = scene->hitP(rh);
+		vec3f hit_n = scene->hitN(rh);
+		vec3f last_dir(rh->ray.dir_x, rh->ray.dir_y, rh->ray.dir_z);
+		vec3f last_color(st->albedo.r[i], st->albedo.g[i], st->albedo.b[i]);
+		Material mat = scene->material(pb->geomID[i], pb->primID[i]);
+
+		for (int sample = 0; sample < n_samples; sample++) {
+			lane[i].set_sample(sample);
+			if (queue_bounce(hit_p, hit_n, last_dir, mat, last_color, vec3f(1.f, 1.f, 1.f), 0,
+				i * n_samples + sample, &lane[i], st, m, &ns)) m++;
+			st->paths++;
+		}
+	}
+
+	for (int b = 0; m > 0 || ns > 0; b++) {
+		if (m > 0) {
+			StageTimer clock(timing, TIMER_GI, &st->gi_ticks);
+			rtcIntersect1M(scene->scene, &st->context, st->stream, m, sizeof(RTCRayHit));
+			st->rays += m;
+			st->segments += m;
+			STAT_ADD(STAT_GI_RAYS, m);
+		}
+		if (ns > 0) {
+			StageTimer clock(timing, TIMER_SHADOW, &st->gi_ticks);
+			rtcOccluded1M(scene->scene, &st->context, st->shadows, ns, sizeof(RTCRay));
+			st->rays += ns;
+			STAT_ADD(STAT_SHADOW_RAYS, ns);
+		}
+		for (int j = 0; j < ns; j++) {
+			if (st->shadows[j].tfar < 0.f) {
+				STAT_INC(STAT_SHADOWED);
+				continue;
+			}
+			int slot = st->shadow_owner[j];
+			sc->r[slot] += st->unshadowed.r[j]; sc->g[slot] += st->unshadowed.g[j]; sc->b[slot] += st->unshadowed.b[j];
+		}
+		ns = 0;
+
+		//emission and surface at the new hits, grouped by object
+		gb->n = 0;
+		for (int k = 0; k < m; k++) {
+			add_hit(gb, &st->stream[k], 0.f);
+		}
+		scene->group(gb);
+		scene->emit_batch(gb, &st->incoming);
+		for (int k = 0; k < m; k++) {
+			gb->width[k] = segment_width(st->stream[k].ray.tfar, st->bsdf_pdf[k]);
+		}
+		scene->color_batch(gb, &st->hit_albedo);
+
+		//surviving paths are packed to the front of the stream
+		RTColorBatch * a = &st->hit_albedo;
+		RTColorBatch * e = &st->incoming;
+		int next = 0;
+		for (int k = 0; k < m; k++) {
+			int slot = st->owner[k];
+			vec3f thr(tp->r[k], tp->g[k], tp->b[k]);
+			if (gb->geomID[k] == RTC_INVALID_GEOMETRY_ID) {
+				STAT_INC(STAT_GI_MISSES);
+				if (!scene->env) continue;
+				RTCRayHit * g = &st->stream[k];
+				vec3f dir(g->ray.dir_x, g->ray.dir_y, g->ray.dir_z);
+				vec3f c = thr * scene->environment(dir, 0.f);
+				sc->r[slot] += c.x; sc->g[slot] += c.y; sc->b[slot] += c.z;
+				continue;
+			}
+			STAT_HIT(gb->geomID[k]);
+			vec3f emission(e->r[k], e->g[k], e->b[k]);
+			float mis = bsdf_weight(gb->geomID[k], &st->stream[k], st->bsdf_pdf[k]);
+			vec3f c = thr * emission * mis;
+			sc->r[slot] += c.x; sc->g[slot] += c.y; sc->b[slot] += c.z;
+
+			if (b + 1 == max_depth || !scene->scatters(gb->geomID[k], gb->primID[k])) continue;
+			vec3f f(a->r[k], a->g[k], a->b[k]);
+
+			Sampler * s = &lane[slot / n_samples];
+			s->set_sample(slot % n_samples);
+			if (b + 1 >= RR_DEPTH) {
+				float q = survival(thr, f);
+				if (s->roulette(b) >= q) {
+					STAT_INC(STAT_ROULETTE_KILLS);
+					continue;
+				}
+				thr = thr * (1.f / q);
+			}
+
+			RTCRayHit * g = &st->stream[k];
+			vec3f p = scene->hitP(g);
+			vec3f nn = scene->hitN(g);
+			vec3f in_dir(g->ray.dir_x, g->ray.dir_y, g->ray.dir_z);
+			Material mat = scene->material(gb->geomID[k], gb->primID[k]);
+			if (queue_bounce(p, nn, in_dir, mat, f, thr, b + 1, slot, s, st, next, &ns)) next++;
+		}
+		m = next;
+	}
+
+	RTColorBatch * d = &st->direct;
+	for (int i = 0; i < n; i++) {
+		if (!valid[i]) continue;
+		if (pb->geomID[i] == RTC_INVALID_GEOMETRY_ID) {
+			STAT_INC(STAT_PRIMARY_MISSES);
+			RTCRayHit8 * p = &st->packet;
+			vec3f dir(p->ray.dir_x[i], p->ray.dir_y[i], p->ray.dir_z[i]);
+			vec3f bg = scene->environment(dir, scene->cam->spread());
+			if (features) features->set(u0 + i, v, bg, vec3f(0.f, 0.f, 0.f), 0.f, -1);
+			store(u0 + i, v, bg, vec3f(0.f, 0.f, 0.f), 0.f, st);
+			continue;
+		}
+		if (features) {
+			packet_lane(&st->packet, i, rh);
+			vec3f a = scatters[i] ? vec3f(st->albedo.r[i], st->albedo.g[i], st->albedo.b[i])
+				: vec3f(d->r[i], d->g[i], d->b[i]);
+			features->set(u0 + i, v, a, scene->hitN(rh), rh->ray.tfar, pb->geomID[i]);
+		}
+		vec3f g_illum(0.f, 0.f, 0.f);
+		float g_sq = 0.f;
+		if (scatters[i]) {
+			for (int sample = 0; sample < n_samples; sample++) {
+				int slot = i * n_samples + sample;
+				vec3f c(sc->r[slot], sc->g[slot], sc->b[slot]);
+				float y = luminance(c);
+				g_illum += c;
+				g_sq += y * y;
+			}
+		}
+		store(u0 + i, v, vec3f(d->r[i], d->g[i], d->b[i]), g_illum, g_sq, st);
+	}
+}
+
+//queues the light sample and the next segment of a path at vertex p,
+//which has normal n, material mat, albedo f and throughput thr. the
+//segment goes in stream slot m, the shadow ray (if any) at *ns. false
+//if the path was absorbed and has no next segment
+bool RTRenderer::queue_bounce(const vec3f & p, const vec3f & n, const vec3f & in_dir, const Material & mat, const vec3f & f,
+		const vec3f & thr, int b, int slot, const Sampler * s, RTRayState * st, int m, int * ns) {
+	float backside = in_dir.dot(n) > 0.f ? -1.f : 1.f;
+
+	vec3f lc;
+	if (lights && !material_delta(&mat) && light_sample(p, n * backside, in_dir, &mat, thr * f, b, s, &st->shadows[*ns], &lc)) {
+		st->unshadowed.r[*ns] = lc.x; st->unshadowed.g[*ns] = lc.y; st->unshadowed.b[*ns] = lc.z;
+		st->shadow_owner[*ns] = slot;
+		(*ns)++;
+	}
+
+	vec3f out_dir;
+	float w, pdf;
+	if (!sample_bounce(&mat, n, backside, in_dir, b, s, &out_dir, &w, &pdf)) return false;
+
+	RTCRayHit * g = &st->stream[m];
+	scene->resetRH(g);
+	setRayOrg(g, p);
+	setRayDir(g, out_dir);
+	vec3f t = thr * f * w;
+	st->throughput.r[m] = t.x; st->throughput.g[m] = t.y; st->throughput.b[m] = t.z;
+	st->bsdf_pdf[m] = pdf;
+	st->owner[m] = slot;
+	return true;
+}
+
+//picks a light for bounce b of the current sample as seen from p with
+//oriented normal n, material m and albedo f (throughput included), for
+//a path that arrived along in_dir. fills in the shadow ray and *c, the
+//weighted contribution should it turn out unoccluded
+bool RTRenderer::light_sample(const vec3f & p, const vec3f & n, const vec3f & in_dir, const Material * m, const vec3f & f,
+		int b, const Sampler * s, RTCRay * shadow, vec3f * c) {
+	float u1, u2, dist, pdf_l;
+	vec3f dir, le;
+	s->light2(b, &u1, &u2);
+	if (!lights->sample(p, u1, u2, &dir, &dist, &le, &pdf_l)) return false;
+
+	float cos_x = n.dot(dir);
+	if (cos_x <= 0.f || pdf_l <= 0.f || luminance(le) <= 0.f) return false;
+
+	float pdf_b;
+	float brdf = eval_bounce(m, n, in_dir, dir, s, &pdf_b);
+	if (brdf <= 0.f) return false;
+	float mis = mis_weight(pdf_l, pdf_b);
+	*c = f * le * (brdf * cos_x * mis / pdf_l);
+
+	shadow->org_x = p.x; shadow->org_y = p.y; shadow->org_z = p.z;
+	shadow->dir_x = dir.x; shadow->dir_y = dir.y; shadow->dir_z = dir.z;
+	shadow->tnear = 0.01f; shadow->tfar = dist * (1.f - 1e-3f);
+	shadow->time = 0.f; shadow->mask = -1; shadow->id = 0; shadow->flags = 0;
+	return true;
+}
+
+//MIS weight of a GI ray that hit id; pdf_b is the density it was
+//sampled with, 0 for a delta lobe, which light samples can't find.
+//emitters the lights don't cover keep the full weight too
+float RTRenderer::bsdf_weight(int id, RTCRayHit * rh, float pdf_b) const {
+	if (!lights || pdf_b <= 0.f) return 1.f;
+	vec3f dir(rh->ray.dir_x, rh->ray.dir_y, rh->ray.dir_z);
+	float pdf_l = lights->pdf(id, rh->hit.primID, rh->hit.u, rh->hit.v, dir, rh->ray.tfar);
+	return pdf_l > 0.f ? mis_weight(pdf_b, pdf_l) : 1.f;
+}
+
+//gi is the sum over this pass's samples, gi_sq the sum of their
+//squared luminances; sample j is direct + gi_j
+void RTRenderer::store(int u, int v, const vec3f & direct, const vec3f & gi, float gi_sq, RTRayState * st) {
+	if (accum) {
+		float n = (float)n_samples, yd = luminance(direct);
+		accum->add(u, v, direct * n + gi, n_samples, n * yd * yd + 2.f * yd * luminance(gi) + gi_sq);
+		return;
+	}
+	vec3f illum = direct + gi * (1.f / (float)n_samples);
+	Tile * t = st->tile;
+	float * p = &st->pixels[3 * ((v - t->y0) * (t->x1 - t->x0) + (u - t->x0))];
+	p[0] = illum.x; p[1] = illum.y; p[2] = illum.z;
+}
+
+//footprint of a camera ray at its hit
+float RTRenderer::primary_width(RTCRayHit * rh) const {
+	vec3f dir(rh->ray.dir_x, rh->ray.dir_y, rh->ray.dir_z);
+	return rh->ray.tfar * dir.abs() * scene->cam->spread();
+}
+
+//samples the pixel already has, so each pass continues its sequence
+uint32_t RTRenderer::first_sample(int u, int v) const {
+	return (accum ? accum->count[v * accum->width + u] : 0) + sample_offset;
+}
+
+//seeds the pixel's samples by where it is in the camera's frame
+uint64_t RTRenderer::pixel_index(int u, int v) const {
+	return (uint64_t)(v + y0) * scene->cam->width + u + x0;
+}
+
+int RTRenderer::progressive(int target_spp, double budget, char * checkpoint, char * preview, const PostParams * post) {
+	double start = wall_time(), last = 0.0;
+	long pixels = (long)width * height;
+	long spp = accum->max_samples();
+	long total_rays = 0, total_paths = 0, total_segments = 0;
+	double stages[4] = {0.0, 0.0, 0.0, 0.0};
+	long active = pixels;
+	int done = 0;
+
+	if (threshold > 0.f) active = accum->converge(threshold, min_spp);
+
+	while (spp < target_spp && active > 0) {
+		//don't start a pass that won't fit in the budget
+		if (budget > 0.0 && wall_time() - start + last > budget) break;
+
+		render();
+		accum->passes++;
+		spp += n_samples;
+		total_rays += rays;
+		total_paths += paths;
+		total_segments += segments;
+		stages[0] += primary_seconds; stages[1] += gi_seconds;
+		stages[2] += shade_seconds; stages[3] += write_seconds;
+		last = seconds;
+		done++;
+
+		//only pixels still above the error threshold get the next pass
+		if (threshold > 0.f) active = accum->converge(threshold, min_spp);
+
+		if (checkpoint && accum->save(checkpoint) < 0) {
+			printf("Could not write checkpoint %s\n", checkpoint);
+		}
+		if (preview) {
+			double t0 = wall_time();
+			ImageFile image;
+			image.post = *post;
+			if (image.open(preview, width, height, tile_size) == 0) {
+				accum->resolve(&image);
+				image.close();
+			}
+			if (timing) stages[3] += wall_time() - t0;
+		}
+		if (threshold > 0.f) {
+			printf("Pass %d: %ld spp, %ld pixels active in %.2f s\n", accum->passes, spp, active, last);
+		} else {
+			printf("Pass %d: %ld spp in %.2f s\n", accum->passes, spp, last);
+		}
+	}
+
+	if (threshold > 0.f) {
+		printf("Adaptive: %.1f spp on average, %ld pixels unconverged\n",
+			(double)accum->total_samples() / pixels, active);
+	}
+
+	rays = total_rays;
+	paths = total_paths;
+	segments = total_segments;
+	primary_seconds = stages[0]; gi_seconds = stages[1];
+	shade_seconds = stages[2]; write_seconds = stages[3];
+	seconds = wall_time() - start;
+	return done;
+}
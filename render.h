@@ -0,0 +1,128 @@
+#ifndef __RENDER_H
+#define __RENDER_H
+
+#include <embree3/rtcore.h>
+#include <mutex>
+#include <time.h>
+
+#include "RTObject.h"
+#include "image.h"
+#include "tiles.h"
+#include "sampler.h"
+#include "batch.h"
+#include "accum.h"
+#include "light.h"
+#include "aov.h"
+
+//everything a worker thread touches while tracing
+typedef struct {
+	RTCRayHit rh;
+	RTCRay shadow;
+	RTCRayHit8 packet;
+	RTCIntersectContext context;
+	RTCIntersectContext coherent;
+	Sampler sampler;
+	//GI ray stream and shading batches for packet mode
+	RTCRayHit * stream;
+	float * bsdf_pdf;
+	int * owner;
+	//shadow rays for light samples, with their unoccluded contribution
+	RTCRay * shadows;
+	int * shadow_owner;
+	RTHitBatch primary, bounce;
+	RTColorBatch albedo, direct, incoming, unshadowed;
+	//surface and path throughput at each segment's hit
+	RTColorBatch hit_albedo, throughput;
+	//per-sample totals, lane * n_samples + sample
+	RTColorBatch samples;
+	//the tile being rendered and its finished pixels, row-major
+	Tile * tile;
+	float * pixels;
+	long rays;
+	long paths, segments;
+	//stage times in stats_ticks() when the renderer is timing
+	uint64_t primary_ticks, gi_ticks, write_ticks, tile_ticks;
+} RTRayState;
+
+enum {
+	TRACE_SCALAR,
+	TRACE_PACKET,
+};
+
+//renders a frame in tiles across a pool of threads
+class RTRenderer {
+public:
+	RTRenderer(RTScene * s, int w, int h);
+public:
+	void render();
+	int progressive(int target_spp, double budget, char * checkpoint, char * preview, const PostParams * post);
+public:
+	int width, height;
+	//finished tiles are written here as they come, when not accumulating
+	ImageFile * output;
+	int n_samples;
+	int n_threads;
+	int tile_size;
+	int mode;
+	int sampling;
+	unsigned int seed;
+	//when set, every GI sample also picks a light (next event) and the
+	//two are combined with MIS
+	RTLights * lights;
+	//segments per path; longer paths also end by russian roulette
+	int max_depth;
+	//when set, samples are added here instead of written to output
+	Accum * accum;
+	//when set, the camera hit of every pixel is recorded here
+	AOV * features;
+	//progressive: stop sampling a pixel once it has min_spp samples
+	//and its relative error is below threshold (0 = never)
+	float threshold;
+	int min_spp;
+	//time the stages below; reads the clock around every trace call
+	bool timing;
+	//a job of a frame split between processes renders only its part
+	//of the tiles (see TileQueue), and its samples of each pixel start
+	//at sample_offset, so jobs with the same seed never repeat a sample
+	int part, parts;
+	uint32_t sample_offset;
+	//the frame is the window of the camera's from (x0, y0); a window
+	//gets the same rays and samples as those pixels of the whole frame
+	int x0, y0;
+public:
+	long rays;
+	long paths, segments;
+	double seconds;
+	//camera rays, GI and shadow rays, everything else and tile
+	//writes, in seconds per thread
+	double primary_seconds, gi_seconds, shade_seconds, write_seconds;
+private:
+	void worker(TileQueue * q, int id);
+	void render_tile(Tile * t, RTRayState * st);
+	void render_px(int u, int v, RTRayState * st);
+	void render_tile_packet(Tile * t, RTRayState * st);
+	void shade_packet(int u0, int v, int n, int * valid, RTRayState * st);
+	vec3f trace_path(vec3f p, vec3f n, vec3f in_dir, vec3f f, Material m, RTRayState * st);
+	bool queue_bounce(const vec3f & p, const vec3f & n, const vec3f & in_dir, const Material & mat, const vec3f & f,
+		const vec3f & thr, int b, int slot, const Sampler * s, RTRayState * st, int m, int * ns);
+	bool light_sample(const vec3f & p, const vec3f & n, const vec3f & in_dir, const Material * m, const vec3f & f,
+		int b, const Sampler * s, RTCRay * shadow, vec3f * c);
+	float bsdf_weight(int id, RTCRayHit * rh, float pdf_b) const;
+	void store(int u, int v, const vec3f & direct, const vec3f & gi, float gi_sq, RTRayState * st);
+	uint32_t first_sample(int u, int v) const;
+	uint64_t pixel_index(int u, int v) const;
+	float primary_width(RTCRayHit * rh) const;
+private:
+	RTScene * scene;
+	std::mutex lock;
+};
+
+//monotonic clock in seconds; inline so tools that only time themselves
+//(tonemap) need not link the renderer
+inline double wall_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#endif
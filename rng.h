@@ -0,0 +1,33 @@
+#ifndef __RNG_H
+#define __RNG_H
+
+#include <stdint.h>
+
+//PCG32, one stream per pixel so the image doesn't depend on
+//which thread rendered it or in what order
+class RNG {
+public:
+	RNG() {state = 0; inc = 1;}
+	RNG(uint64_t seed, uint64_t stream) {init(seed, stream);}
+public:
+	void init(uint64_t seed, uint64_t stream) {
+		state = 0;
+		inc = (stream << 1u) | 1u;
+		next();
+		state += seed;
+		next();
+	}
+	uint32_t next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = (uint32_t)(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+	}
+	//uniform in [0, 1)
+	float uniform() {return (float)(next() >> 8) * (1.f / 16777216.f);}
+private:
+	uint64_t state, inc;
+};
+
+#endif
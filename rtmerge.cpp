@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "accum.h"
+#include "image.h"
+#include "post.h"
+
+void usage() {
+	printf("Usage: rtmerge [options] out.bmp|out.pfm|out.rtt part1 part2 ...\n");
+	printf("  -e EV    BMP output: exposure in stops\n");
+	printf("  -M TONE  BMP output: clamp (default), aces or filmic\n");
+	printf("  -k FILE  also write the merged samples, which embree_test -k can resume\n");
+	printf("  -t SIZE  tile size of .rtt output (default 16)\n");
+}
+
+//combines the sample buffers of jobs that rendered parts of a frame
+//(embree_test -W) into the final image: sums and counts add, so each
+//pixel is weighted by the samples every job gave it
+int main(int argc, char** argv) {
+	PostParams post;
+	post_init(&post);
+	char * merged = NULL;
+	int tile_size = 16;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:M:k:t:h")) != -1) {
+		switch (opt) {
+		case 'e': post.exposure = atof(optarg); break;
+		case 'M': if (post_set_tone(&post, optarg) < 0) {usage(); return -1;} break;
+		case 'k': merged = optarg; break;
+		case 't': tile_size = atoi(optarg); break;
+		default: usage(); return -1;
+		}
+	}
+	if (optind + 2 > argc) {
+		usage();
+		return -1;
+	}
+	if (tile_size < 1) tile_size = 16;
+	char * out_name = argv[optind];
+
+	AccumHeader h;
+	if (accum_header(argv[optind + 1], &h) < 0) return -1;
+	Accum accum(h.width, h.height);
+	accum.seed = h.seed;
+	for (int i = optind + 1; i < argc; i++) {
+		if (accum.merge(argv[i]) < 0) return -1;
+	}
+
+	long empty = 0;
+	for (long i = 0; i < (long)h.width * h.height; i++) {
+		if (accum.count[i] == 0) empty++;
+	}
+	if (empty > 0) printf("%ld pixels have no samples; is a job missing?\n", empty);
+	printf("Merged %d buffers of %ux%u, %.1f spp on average\n", argc - optind - 1, h.width, h.height,
+		(double)accum.total_samples() / ((double)h.width * h.height));
+
+	if (merged && accum.save(merged) < 0) {
+		printf("Could not write %s\n", merged);
+		return -1;
+	}
+	ImageFile image;
+	image.post = post;
+	if (image.open(out_name, h.width, h.height, tile_size) < 0) return -1;
+	accum.resolve(&image);
+	return image.close();
+}
@@ -0,0 +1,471 @@
+#include <embree3/rtcore.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+
+#include "geom.h"
+#include "brdf.h"
+#include "render.h"
+#include "RTObject.h"
+#include "light.h"
+#include "scene.h"
+
+void usage() {
+	printf("Usage: rtserve [options]\n");
+	printf("  -u PATH  listen on a UNIX socket at PATH (default: stdin and stdout)\n");
+	printf("  -b MB    memory for cached scenes (default 4096); the least recently used\n");
+	printf("           are dropped to stay under it\n");
+	printf("  -j N     render with N threads (default: all cores)\n");
+	printf("  -s SEED  random seed (default 0)\n");
+	printf("  -t SIZE  tile size in pixels (default 16)\n");
+	printf("  -m MODE  scalar (default) or packet\n");
+	printf("  -S KIND  GI directions: uniform, cosine or sobol (default)\n");
+	printf("  -d N     maximum path length in bounces (default 4)\n");
+	printf("  -N       no light sampling\n");
+	printf("  -C       don't read or write .rtm mesh caches beside OBJ files\n");
+	printf("  -e EV    BMP output: exposure in stops\n");
+	printf("  -M TONE  BMP output: clamp (default), aces or filmic\n");
+	printf("Requests come one a line and get one line back, \"ok ...\" or \"error ...\":\n");
+	printf("  load FILE              .scene or .obj, made current with its own camera and size; a file\n");
+	printf("                         with the same contents, whose meshes and textures are unchanged,\n");
+	printf("                         comes from the cache -> ok HASH loaded|cached MB SECONDS\n");
+	printf("  camera EX EY EZ DX DY DZ FOV  move, point and zoom (degrees) this client's camera\n");
+	printf("  resolution W H         this client's frame size\n");
+	printf("  render SPP [X Y W H] [FILE]  the region (default: all) to FILE -> ok FILE SECONDS,\n");
+	printf("                         or inline -> ok W H SECONDS, then W*H*3 floats, rows top down\n");
+	printf("  stats                  -> ok SCENES MB\n");
+	printf("  quit                   stop the server\n");
+}
+
+//how every request is rendered
+typedef struct {
+	int n_threads, tile_size;
+	int mode, sampling, max_depth;
+	bool sample_lights, use_cache;
+	unsigned int seed;
+	PostParams post;
+	long budget;
+} ServerOptions;
+
+//a loaded and committed scene, ready to trace
+typedef struct {
+	uint64_t hash;
+	char name[4096];
+	RTScene * scene;
+	SceneSetup setup;
+	//NULL when not sampling lights
+	RTLights * lights;
+	long bytes;
+	unsigned long used;
+} CachedScene;
+
+//the sky an OBJ is shown under
+static char * default_sky[3] = {(char*)"textures/bliss.bmp", (char*)"textures/grass.bmp", (char*)"textures/cloud.bmp"};
+
+//one client's view of the current scene. camera and resolution
+//requests change this, never the cached scene, so a file renders the
+//same for every client whatever the last one asked for
+typedef struct {
+	//cache slot of the current scene, -1 for none
+	int current;
+	bool moved;
+	vec3f eye, dir;
+	float fov;
+	int width, height;
+} Session;
+
+static CachedScene * cache = NULL;
+static int n_cached = 0, cache_cap = 0;
+static unsigned long ticks = 0;
+
+//FNV-1a, continuing from h
+static uint64_t fnv(uint64_t h, const void * data, size_t n) {
+	const unsigned char * p = (const unsigned char *)data;
+	for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+//a file the loaded scene reads: its full path, size and modification
+//time, which is enough to notice an edited mesh without reading it
+static void hash_input(const char * fname, void * arg) {
+	uint64_t * h = (uint64_t *)arg;
+	char path[PATH_MAX];
+	struct stat st;
+	if (!realpath(fname, path) || stat(path, &st) < 0) {
+		//a missing file fails the load, so its name is enough
+		*h = fnv(*h, fname, strlen(fname) + 1);
+		return;
+	}
+	*h = fnv(*h, path, strlen(path) + 1);
+	int64_t id[3] = {(int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec};
+	*h = fnv(*h, id, sizeof(id));
+}
+
+//over the file's full path and contents, then the files it names; a
+//scene file's meshes and textures are named relative to it, so the
+//path is part of what it means
+static int hash_file(char * fname, uint64_t * hash) {
+	char path[PATH_MAX];
+	FILE * f = realpath(fname, path) ? fopen(path, "rb") : NULL;
+	if (!f) return -1;
+	uint64_t h = fnv(14695981039346656037ULL, path, strlen(path));
+	unsigned char * buf = (unsigned char *)malloc(1 << 20);
+	if (!buf) {
+		fclose(f);
+		return -1;
+	}
+	size_t n;
+	while ((n = fread(buf, 1, 1 << 20, f)) > 0) h = fnv(h, buf, n);
+	bool ok = !ferror(f);
+	free(buf);
+	fclose(f);
+	if (ok && is_scene_file(fname)) {
+		ok = scene_inputs(fname, hash_input, &h) == 0;
+	} else if (ok) {
+		for (int i = 0; i < 3; i++) hash_input(default_sky[i], &h);
+	}
+	*hash = h;
+	return ok ? 0 : -1;
+}
+
+static void drop(CachedScene * c) {
+	delete c->lights;
+	free_setup(&c->setup);
+	c->scene->cleanup();
+	delete c->scene;
+}
+
+//loads and commits a scene file, or an OBJ under the default sky as
+//embree_test shows it
+static int load(CachedScene * c, char * fname, const ServerOptions * o) {
+	RTScene * s = new RTScene();
+	c->scene = s;
+	c->lights = NULL;
+	default_setup(&c->setup);
+	int ret;
+	if (is_scene_file(fname)) {
+		ret = load_scene(s, fname, &c->setup, o->n_threads, o->use_cache);
+	} else {
+		c->setup.sky = new RTSkyBox(s, 30.f, vec3f(0.f, 0.f, 0.f));
+		ret = c->setup.sky->loadFile(default_sky[0], default_sky[1], default_sky[2]);
+		Material m;
+		material_init(&m);
+		RTTriangleMesh * mesh = new RTTriangleMesh(s, m, emit_black);
+		mesh->use_cache = o->use_cache;
+		if (ret == 0) ret = mesh->loadFile(fname);
+	}
+	if (ret < 0) {
+		drop(c);
+		return -1;
+	}
+	setup_frame(s, &c->setup, 0);
+	s->commit();
+
+	RTSkyBox * sky = c->setup.sky;
+	if (o->sample_lights && sky) {
+		c->lights = new RTLights(s);
+		sky->add_lights(c->lights);
+		if (c->lights->build(64) < 0) {
+			delete c->lights;
+			c->lights = NULL;
+		}
+	}
+	c->bytes = s->memory();
+	return 0;
+}
+
+//drops the least recently used scenes, but never keep, until the rest
+//fit the budget; returns where keep ends up
+static int evict(int keep, long budget) {
+	long total = 0;
+	for (int i = 0; i < n_cached; i++) total += cache[i].bytes;
+	while (total > budget) {
+		int lru = -1;
+		for (int i = 0; i < n_cached; i++) {
+			if (i != keep && (lru < 0 || cache[i].used < cache[lru].used)) lru = i;
+		}
+		if (lru < 0) break;
+		printf("Dropping %s (%.1f MB)\n", cache[lru].name, cache[lru].bytes / 1048576.0);
+		total -= cache[lru].bytes;
+		drop(&cache[lru]);
+		cache[lru] = cache[--n_cached];
+		if (keep == n_cached) keep = lru;
+	}
+	if (total > budget) printf("%s alone is over the memory budget\n", cache[keep].name);
+	return keep;
+}
+
+//points the shared camera the session's way: the file's frame 0,
+//then whatever the session changed
+static void apply_view(CachedScene * c, const Session * v) {
+	setup_camera(c->scene, &c->setup, 0);
+	if (v->moved) {
+		c->scene->move(v->eye.x, v->eye.y, v->eye.z);
+		c->scene->point(v->dir.x, v->dir.y, v->dir.z);
+		c->scene->zoom(v->fov);
+	}
+	c->scene->resize(v->width, v->height);
+}
+
+//answers "load FILE", which starts the session's view over from the file
+static void do_load(FILE * out, char * fname, Session * v, const ServerOptions * o) {
+	double t0 = wall_time();
+	uint64_t hash;
+	if (hash_file(fname, &hash) < 0) {
+		fprintf(out, "error could not read %s\n", fname);
+		return;
+	}
+	int i;
+	for (i = 0; i < n_cached; i++) {
+		if (cache[i].hash == hash) break;
+	}
+	bool hit = i < n_cached;
+	if (!hit) {
+		if (n_cached == cache_cap) {
+			int cap = cache_cap ? 2 * cache_cap : 8;
+			CachedScene * grown = (CachedScene *)realloc(cache, cap * sizeof(CachedScene));
+			if (!grown) {
+				fprintf(out, "error out of memory\n");
+				return;
+			}
+			cache = grown;
+			cache_cap = cap;
+		}
+		CachedScene * c = &cache[n_cached];
+		if (load(c, fname, o) < 0) {
+			fprintf(out, "error could not load %s\n", fname);
+			return;
+		}
+		c->hash = hash;
+		snprintf(c->name, sizeof(c->name), "%s", fname);
+		n_cached++;
+	}
+	cache[i].used = ++ticks;
+	v->current = evict(i, o->budget);
+	CachedScene * c = &cache[v->current];
+	v->moved = false;
+	v->width = c->setup.width;
+	v->height = c->setup.height;
+	fprintf(out, "ok %016llx %s %.1f %.4f\n", (unsigned long long)hash, hit ? "cached" : "loaded",
+		c->bytes / 1048576.0, wall_time() - t0);
+}
+
+//answers "render SPP [X Y W H] [FILE]"
+static void do_render(FILE * out, CachedScene * c, const Session * v, int argc, char ** argv, const ServerOptions * o) {
+	int w = v->width, h = v->height;
+	int x = 0, y = 0, rw = w, rh = h;
+	char * fname = NULL;
+	if (argc == 3 || argc == 7) fname = argv[argc - 1];
+	if (argc >= 6) {
+		x = atoi(argv[2]); y = atoi(argv[3]);
+		rw = atoi(argv[4]); rh = atoi(argv[5]);
+	}
+	int spp = atoi(argv[1]);
+	if ((argc != 2 && argc != 3 && argc != 6 && argc != 7) || spp < 1) {
+		fprintf(out, "error render SPP [X Y W H] [FILE]\n");
+		return;
+	}
+	if (x < 0 || y < 0 || rw < 1 || rh < 1 || x + rw > w || y + rh > h) {
+		fprintf(out, "error the region is not inside the %dx%d frame\n", w, h);
+		return;
+	}
+
+	apply_view(c, v);
+	RTRenderer r(c->scene, rw, rh);
+	r.n_samples = spp;
+	r.n_threads = o->n_threads;
+	r.tile_size = o->tile_size;
+	r.mode = o->mode;
+	r.sampling = o->sampling;
+	r.lights = c->lights;
+	r.max_depth = o->max_depth;
+	r.seed = o->seed;
+	r.x0 = x;
+	r.y0 = y;
+	Accum accum(rw, rh);
+	r.accum = &accum;
+	r.render();
+	r.accum = NULL;
+
+	if (fname) {
+		ImageFile image;
+		image.post = o->post;
+		int ret = image.open(fname, rw, rh, o->tile_size);
+		if (ret == 0) {
+			accum.resolve(&image);
+			ret = image.close();
+		}
+		if (ret < 0) fprintf(out, "error could not write %s\n", fname);
+		else fprintf(out, "ok %s %.4f\n", fname, r.seconds);
+		return;
+	}
+	float * rgb = (float *)malloc(3 * (size_t)rw * rh * sizeof(float));
+	accum.resolve(rgb);
+	fprintf(out, "ok %d %d %.4f\n", rw, rh, r.seconds);
+	fwrite(rgb, sizeof(float), 3 * (size_t)rw * rh, out);
+	free(rgb);
+}
+
+//reads requests until the client goes or asks the server to quit;
+//returns 1 for quit
+static int serve(FILE * in, FILE * out, const ServerOptions * o) {
+	Session v;
+	v.current = -1;
+	v.moved = false;
+	v.eye = v.dir = vec3f(0.f, 0.f, 0.f);
+	v.fov = 0.f;
+	v.width = v.height = 0;
+	char line[8192];
+	while (fgets(line, sizeof(line), in)) {
+		char * argv[16];
+		int argc = 0;
+		for (char * tok = strtok(line, " \t\r\n"); tok && argc < 16; tok = strtok(NULL, " \t\r\n")) {
+			argv[argc++] = tok;
+		}
+		if (argc == 0) continue;
+		//the scene may have been dropped for another client's
+		CachedScene * c = v.current >= 0 && v.current < n_cached ? &cache[v.current] : NULL;
+		if (c) c->used = ++ticks;
+
+		if (!strcmp(argv[0], "quit")) {
+			fprintf(out, "ok\n");
+			fflush(out);
+			return 1;
+		} else if (!strcmp(argv[0], "stats")) {
+			long total = 0;
+			for (int i = 0; i < n_cached; i++) total += cache[i].bytes;
+			fprintf(out, "ok %d %.1f\n", n_cached, total / 1048576.0);
+		} else if (!strcmp(argv[0], "load")) {
+			if (argc != 2) fprintf(out, "error load FILE\n");
+			else do_load(out, argv[1], &v, o);
+		} else if (!c) {
+			fprintf(out, "error no scene loaded\n");
+		} else if (!strcmp(argv[0], "camera")) {
+			float x[7];
+			for (int i = 0; i < 7 && i + 1 < argc; i++) x[i] = atof(argv[i + 1]);
+			if (argc != 8) fprintf(out, "error camera EX EY EZ DX DY DZ FOV\n");
+			else {
+				v.moved = true;
+				v.eye = vec3f(x[0], x[1], x[2]);
+				v.dir = vec3f(x[3], x[4], x[5]);
+				v.fov = x[6] * (float)M_PI / 180.f;
+				fprintf(out, "ok\n");
+			}
+		} else if (!strcmp(argv[0], "resolution")) {
+			int w = argc == 3 ? atoi(argv[1]) : 0, h = argc == 3 ? atoi(argv[2]) : 0;
+			if (w < 1 || h < 1) fprintf(out, "error resolution W H\n");
+			else {
+				v.width = w;
+				v.height = h;
+				fprintf(out, "ok\n");
+			}
+		} else if (!strcmp(argv[0], "render")) {
+			if (argc < 2) fprintf(out, "error render SPP [X Y W H] [FILE]\n");
+			else do_render(out, c, &v, argc, argv, o);
+		} else {
+			fprintf(out, "error unknown request %s\n", argv[0]);
+		}
+		fflush(out);
+	}
+	return 0;
+}
+
+//keeps scenes loaded and their BVHs built between requests, so a
+//request on a cached scene costs only its trace
+int main(int argc, char** argv) {
+	ServerOptions o;
+	o.n_threads = std::thread::hardware_concurrency();
+	o.tile_size = 16;
+	o.mode = TRACE_SCALAR;
+	o.sampling = SAMPLE_SOBOL;
+	o.max_depth = 4;
+	o.sample_lights = true;
+	o.use_cache = true;
+	o.seed = 0;
+	post_init(&o.post);
+	o.budget = 4096L << 20;
+	char * sock_path = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "u:b:j:s:t:m:S:d:NCe:M:h")) != -1) {
+		switch (opt) {
+		case 'u': sock_path = optarg; break;
+		case 'b': o.budget = atol(optarg) << 20; break;
+		case 'j': o.n_threads = atoi(optarg); break;
+		case 's': o.seed = strtoul(optarg, NULL, 10); break;
+		case 't': o.tile_size = atoi(optarg); break;
+		case 'S': o.sampling = parse_sampler(optarg); break;
+		case 'd': o.max_depth = atoi(optarg); break;
+		case 'N': o.sample_lights = false; break;
+		case 'C': o.use_cache = false; break;
+		case 'e': o.post.exposure = atof(optarg); break;
+		case 'M': if (post_set_tone(&o.post, optarg) < 0) {usage(); return -1;} break;
+		case 'm':
+			if (!strcmp(optarg, "scalar")) o.mode = TRACE_SCALAR;
+			else if (!strcmp(optarg, "packet")) o.mode = TRACE_PACKET;
+			else {usage(); return -1;}
+			break;
+		default: usage(); return -1;
+		}
+	}
+	if (o.n_threads < 1) o.n_threads = 1;
+	if (o.tile_size < 1) o.tile_size = 16;
+	if (o.max_depth < 1) o.max_depth = 1;
+	if (o.sampling < 0 || o.budget < 0) {
+		usage();
+		return -1;
+	}
+	//a client that hangs up mid-reply must not end the server
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!sock_path) {
+		//replies alone go to stdout; what the loaders print goes to stderr
+		fflush(stdout);
+		FILE * out = fdopen(dup(1), "w");
+		dup2(2, 1);
+		serve(stdin, out, &o);
+		fclose(out);
+	} else {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+			printf("Socket path %s is too long\n", sock_path);
+			return -1;
+		}
+		strcpy(addr.sun_path, sock_path);
+		int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(sock_path);
+		if (ls < 0 || bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(ls, 4) < 0) {
+			printf("Could not listen on %s\n", sock_path);
+			return -1;
+		}
+		printf("Listening on %s\n", sock_path);
+		fflush(stdout);
+		//one client at a time; the cache outlives each
+		for (bool quit = false; !quit;) {
+			int fd = accept(ls, NULL, NULL);
+			if (fd < 0) continue;
+			FILE * in = fdopen(fd, "r");
+			FILE * out = fdopen(dup(fd), "w");
+			quit = serve(in, out, &o) > 0;
+			fclose(in);
+			fclose(out);
+		}
+		close(ls);
+		unlink(sock_path);
+	}
+
+	for (int i = 0; i < n_cached; i++) drop(&cache[i]);
+	free(cache);
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <math.h>
+#include <string.h>
+
+#include "sampler.h"
+
+inline uint32_t reverse_bits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+//Laine-Karras style hash that only lets bits flow downwards; run on
+//reversed bits it is a nested uniform (Owen) scramble
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverse_bits(x);
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+	return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+//first two Sobol dimensions: van der Corput and the Pascal matrix
+inline uint32_t sobol0(uint32_t i) {
+	return reverse_bits(i);
+}
+
+inline uint32_t sobol1(uint32_t i) {
+	uint32_t x = 0;
+	for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+		if (i & 1) x ^= v;
+	}
+	return x;
+}
+
+//PCG output permutation used as a hash, for the independent modes
+inline uint32_t pcg_hash(uint32_t x) {
+	uint32_t state = x * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+inline float to_unit(uint32_t x) {
+	return (float)(x >> 8) * (1.f / 16777216.f);
+}
+
+void Sampler::start(int k, uint64_t seed, uint64_t pixel, uint32_t first) {
+	kind = k;
+	index = first;
+	current = first;
+	//the scramble only depends on the pixel, so the sequence is shared
+	//by every pass
+	RNG h(seed, pixel);
+	scramble = h.next();
+}
+
+//every pair is a 2D Sobol point, decorrelated from the other pairs by
+//its own shuffle and scramble
+void Sampler::get2(int dim, float * u1, float * u2) const {
+	if (kind != SAMPLE_SOBOL) {
+		uint32_t h = pcg_hash(scramble ^ pcg_hash(current ^ pcg_hash(dim)));
+		*u1 = to_unit(pcg_hash(h));
+		*u2 = to_unit(pcg_hash(h ^ 0x9e3779b9u));
+		return;
+	}
+	uint32_t seed = dim ? hash_combine(scramble, 0x9e3779b9u * dim) : scramble;
+	uint32_t i = owen_scramble(current, seed);
+	*u1 = to_unit(owen_scramble(sobol0(i), hash_combine(seed, 1)));
+	*u2 = to_unit(owen_scramble(sobol1(i), hash_combine(seed, 2)));
+}
+
+vec3f Sampler::hemisphere(int bounce, float * w) const {
+	float u1, u2;
+	get2(3 * bounce, &u1, &u2);
+	float phi = 2.f * (float)M_PI * u2;
+
+	if (kind == SAMPLE_UNIFORM) {
+		//pdf = 1 / (2 pi)
+		float z = u1;
+		float r = sqrtf(fmaxf(0.f, 1.f - z * z));
+		*w = 2.f * z;
+		return vec3f(r * cosf(phi), r * sinf(phi), z);
+	}
+	//pdf = cos / pi, which cancels the cosine term
+	float r = sqrtf(u1);
+	*w = 1.f;
+	return vec3f(r * cosf(phi), r * sinf(phi), sqrtf(fmaxf(0.f, 1.f - u1)));
+}
+
+int parse_sampler(const char * s) {
+	if (!strcmp(s, "uniform")) return SAMPLE_UNIFORM;
+	if (!strcmp(s, "cosine")) return SAMPLE_COSINE;
+	if (!strcmp(s, "sobol")) return SAMPLE_SOBOL;
+	return -1;
+}
+
+const char * sampler_name(int kind) {
+	switch (kind) {
+	case SAMPLE_UNIFORM: return "uniform";
+	case SAMPLE_COSINE: return "cosine";
+	default: return "sobol";
+	}
+}
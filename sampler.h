@@ -0,0 +1,57 @@
+#ifndef __SAMPLER_H
+#define __SAMPLER_H
+
+#include <stdint.h>
+#include <math.h>
+
+#include "geom.h"
+#include "rng.h"
+
+enum {
+	SAMPLE_UNIFORM, //independent points, uniform over the hemisphere
+	SAMPLE_COSINE,  //independent points, cosine-weighted
+	SAMPLE_SOBOL,   //Owen-scrambled Sobol points, cosine-weighted
+};
+
+//hemisphere directions for one pixel. every number is a function of
+//(pixel, sample, dimension) alone, so sample i of a pixel is the same
+//point whichever thread, pass or packet asks for it, in any order, and
+//Sobol sequences carry on across progressive passes
+//
+//each bounce of a path uses three dimension pairs: the direction, the
+//light point, and the roulette with the choice of a material's lobe
+class Sampler {
+public:
+	Sampler() {kind = SAMPLE_SOBOL; scramble = 0; index = 0; current = 0;}
+public:
+	//first is the number of samples the pixel already has
+	void start(int k, uint64_t seed, uint64_t pixel, uint32_t first);
+	//move on to the next sample, or jump to sample first + i
+	void next_sample() {current = index++;}
+	void set_sample(int i) {current = index + i;}
+	//dimension pair dim of the current sample
+	void get2(int dim, float * u1, float * u2) const;
+	//direction around +z for a bounce; *w is cos / (pi * pdf), the
+	//factor that scales a lambertian albedo into the estimator weight
+	vec3f hemisphere(int bounce, float * w) const;
+	//point for picking a light at a bounce
+	void light2(int bounce, float * u1, float * u2) const {get2(3 * bounce + 1, u1, u2);}
+	//uniform number for russian roulette at a bounce
+	float roulette(int bounce) const {float u1, u2; get2(3 * bounce + 2, &u1, &u2); return u1;}
+	//uniform number for picking a lobe at a bounce
+	float lobe(int bounce) const {float u1, u2; get2(3 * bounce + 2, &u1, &u2); return u2;}
+	//the direction's pair at a bounce, for materials that map it themselves
+	void direction2(int bounce, float * u1, float * u2) const {get2(3 * bounce, u1, u2);}
+	//solid angle pdf of hemisphere() for a direction at cos to +z
+	float pdf(float cos) const {return kind == SAMPLE_UNIFORM ? 0.5f / (float)M_PI : cos / (float)M_PI;}
+public:
+	int kind;
+private:
+	uint32_t scramble;
+	uint32_t index, current;
+};
+
+int parse_sampler(const char * s);
+const char * sampler_name(int kind);
+
+#endif
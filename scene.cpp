@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+
+#include "brdf.h"
+#include "render.h"
+#include "scene.h"
+
+//one prototype per distinct file, albedo and material
+typedef struct {
+	char path[4096];
+	vec3f albedo;
+	Material material;
+	RTTriangleMesh * mesh;
+} SceneMesh;
+
+//a mesh's file size, for ordering the loads
+typedef struct {
+	off_t size;
+	int mesh;
+} MeshOrder;
+
+typedef struct {
+	int mesh;
+	matrix3f m;
+	vec3f t;
+	//per frame, for sequences
+	int axis;
+	float spin;
+	vec3f drift;
+} ScenePlacement;
+
+void default_setup(SceneSetup * setup) {
+	setup->width = 1000;
+	setup->height = 1000;
+	setup->eye = vec3f(5.f, 8.f, 0.f);
+	setup->dir = vec3f(-1.f, -1.5f, 0.f);
+	setup->fov = 0.8f;
+	setup->sky = NULL;
+	setup->n_meshes = 0;
+	setup->n_placements = 0;
+	setup->load_seconds = 0.0;
+	setup->texture_seconds = 0.0;
+	setup->frames = 1;
+	setup->n_keys = 0;
+	setup->n_moving = 0;
+	setup->keys = NULL;
+	setup->moving = NULL;
+}
+
+void free_setup(SceneSetup * setup) {
+	free(setup->keys);
+	free(setup->moving);
+	setup->keys = NULL;
+	setup->moving = NULL;
+	setup->n_keys = setup->n_moving = 0;
+}
+
+bool is_scene_file(char * fname) {
+	size_t n = strlen(fname), e = strlen(SCENE_EXT);
+	return n > e && !strcmp(fname + n - e, SCENE_EXT);
+}
+
+//names in a scene file are relative to the file itself
+static void resolve(char * scene, char * name, char * out, size_t len) {
+	const char * slash = strrchr(scene, '/');
+	if (name[0] == '/' || !slash) {
+		snprintf(out, len, "%s", name);
+		return;
+	}
+	snprintf(out, len, "%.*s/%s", (int)(slash - scene), scene, name);
+}
+
+//reads n floats from the rest of the line
+static int read_floats(float * x, int n) {
+	for (int i = 0; i < n; i++) {
+		char * tok = strtok(NULL, " \t\r\n");
+		if (!tok) return -1;
+		char * end;
+		x[i] = strtof(tok, &end);
+		if (*end) return -1;
+	}
+	return 0;
+}
+
+static int parse_axis(char * s) {
+	if (!s) return -1;
+	return !strcmp(s, "x") ? AXIS_X : !strcmp(s, "y") ? AXIS_Y : !strcmp(s, "z") ? AXIS_Z : -1;
+}
+
+//the rest of a mesh line: its albedo, material, a transform whose
+//steps apply in the order written, and how it moves each frame
+static int parse_mesh(SceneMesh * sm, ScenePlacement * p) {
+	sm->albedo = vec3f(1.f, 1.f, 1.f);
+	material_init(&sm->material);
+	matrix3f * m = &p->m;
+	vec3f * t = &p->t;
+	*m = scaling(1.f);
+	*t = vec3f(0.f, 0.f, 0.f);
+	p->axis = AXIS_Y;
+	p->spin = 0.f;
+	p->drift = vec3f(0.f, 0.f, 0.f);
+
+	for (char * tok = strtok(NULL, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+		float x[3];
+		if (!strcmp(tok, "color")) {
+			if (read_floats(x, 3) < 0) return -1;
+			sm->albedo = vec3f(x[0], x[1], x[2]);
+		} else if (!strcmp(tok, "material")) {
+			//lambert, ggx ROUGHNESS or glass IOR
+			char * name = strtok(NULL, " \t\r\n");
+			char * param = name && strcmp(name, "lambert") ? strtok(NULL, " \t\r\n") : NULL;
+			if (!name || parse_material(name, param, &sm->material) < 0) return -1;
+		} else if (!strcmp(tok, "scale")) {
+			if (read_floats(x, 1) < 0) return -1;
+			*m = scaling(x[0]) * *m;
+			*t = *t * x[0];
+		} else if (!strcmp(tok, "rotate")) {
+			int a = parse_axis(strtok(NULL, " \t\r\n"));
+			if (a < 0 || read_floats(x, 1) < 0) return -1;
+			matrix3f r = rotation(x[0] * (float)M_PI / 180.f, a);
+			*m = r * *m;
+			*t = r * *t;
+		} else if (!strcmp(tok, "translate")) {
+			if (read_floats(x, 3) < 0) return -1;
+			*t += vec3f(x[0], x[1], x[2]);
+		} else if (!strcmp(tok, "spin")) {
+			p->axis = parse_axis(strtok(NULL, " \t\r\n"));
+			if (p->axis < 0 || read_floats(x, 1) < 0) return -1;
+			p->spin = x[0] * (float)M_PI / 180.f;
+		} else if (!strcmp(tok, "drift")) {
+			if (read_floats(x, 3) < 0) return -1;
+			p->drift = vec3f(x[0], x[1], x[2]);
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//takes the next mesh off the list until there are none left
+static void load_worker(SceneMesh * meshes, MeshOrder * order, int n, std::atomic<int> * next, std::atomic<int> * failed) {
+	for (int i = (*next)++; i < n; i = (*next)++) {
+		SceneMesh * sm = &meshes[order[i].mesh];
+		if (sm->mesh->loadFile(sm->path) < 0) (*failed)++;
+	}
+}
+
+//biggest files first, so the longest load isn't left until last
+static int by_size(const void * a, const void * b) {
+	off_t x = ((const MeshOrder *)a)->size, y = ((const MeshOrder *)b)->size;
+	return x > y ? -1 : (x < y ? 1 : 0);
+}
+
+//every mesh becomes a prototype placed by instances, so its BVH is
+//built on a loader thread as soon as it is read, and the top level
+//commit only has the instances left to sort
+int load_scene(RTScene * s, char * fname, SceneSetup * setup, int n_threads, bool use_cache) {
+	double start = wall_time();
+	FILE * f = fopen(fname, "r");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+
+	int n_meshes = 0, mesh_cap = 16;
+	int n_places = 0, place_cap = 16;
+	SceneMesh * meshes = (SceneMesh *)malloc(mesh_cap * sizeof(SceneMesh));
+	ScenePlacement * places = (ScenePlacement *)malloc(place_cap * sizeof(ScenePlacement));
+	char sky_names[3][4096];
+	float sky_size = 0.f;
+	char env_name[4096];
+	float env_rotation = 0.f, env_intensity = 1.f;
+	env_name[0] = 0;
+
+	int key_cap = 0;
+	int frames = 0;
+
+	char line[8192];
+	int ret = 0;
+	for (int ln = 1; ret == 0 && fgets(line, sizeof(line), f); ln++) {
+		char * key = strtok(line, " \t\r\n");
+		if (!key || key[0] == '#') continue;
+
+		float x[8];
+		if (!strcmp(key, "resolution")) {
+			if (read_floats(x, 2) < 0 || x[0] < 1.f || x[1] < 1.f) ret = -1;
+			else {setup->width = (int)x[0]; setup->height = (int)x[1];}
+		} else if (!strcmp(key, "camera")) {
+			if (read_floats(x, 7) < 0) ret = -1;
+			else {
+				setup->eye = vec3f(x[0], x[1], x[2]);
+				setup->dir = vec3f(x[3], x[4], x[5]);
+				setup->fov = x[6] * (float)M_PI / 180.f;
+			}
+		} else if (!strcmp(key, "frames")) {
+			if (read_floats(x, 1) < 0 || x[0] < 1.f) ret = -1;
+			else frames = (int)x[0];
+		} else if (!strcmp(key, "key")) {
+			//keys come in frame order
+			int n = setup->n_keys;
+			if (read_floats(x, 8) < 0 || x[0] < 0.f || (n > 0 && (int)x[0] <= setup->keys[n - 1].frame)) ret = -1;
+			else {
+				if (n == key_cap) {
+					key_cap = key_cap ? 2 * key_cap : 16;
+					setup->keys = (CameraKey *)realloc(setup->keys, key_cap * sizeof(CameraKey));
+				}
+				CameraKey * k = &setup->keys[setup->n_keys++];
+				k->frame = (int)x[0];
+				k->eye = vec3f(x[1], x[2], x[3]);
+				k->dir = vec3f(x[4], x[5], x[6]);
+				k->fov = x[7] * (float)M_PI / 180.f;
+			}
+		} else if (!strcmp(key, "skybox")) {
+			sky_size = 30.f;
+			for (int i = 0; i < 3 && ret == 0; i++) {
+				char * name = strtok(NULL, " \t\r\n");
+				if (!name) ret = -1;
+				else resolve(fname, name, sky_names[i], sizeof(sky_names[i]));
+			}
+			char * size = strtok(NULL, " \t\r\n");
+			if (size) sky_size = atof(size);
+		} else if (!strcmp(key, "environment")) {
+			char * name = strtok(NULL, " \t\r\n");
+			if (!name) ret = -1;
+			else {
+				resolve(fname, name, env_name, sizeof(env_name));
+				char * rot = strtok(NULL, " \t\r\n");
+				char * k = rot ? strtok(NULL, " \t\r\n") : NULL;
+				if (rot) env_rotation = atof(rot) * (float)M_PI / 180.f;
+				if (k) env_intensity = atof(k);
+			}
+		} else if (!strcmp(key, "mesh")) {
+			char * name = strtok(NULL, " \t\r\n");
+			SceneMesh sm;
+			ScenePlacement p;
+			if (!name || parse_mesh(&sm, &p) < 0) ret = -1;
+			else {
+				resolve(fname, name, sm.path, sizeof(sm.path));
+				//the same file with the same look is loaded once
+				int i;
+				for (i = 0; i < n_meshes; i++) {
+					SceneMesh * o = &meshes[i];
+					const Material * a = &o->material, * b = &sm.material;
+					bool same = a->kind == b->kind && a->roughness == b->roughness && a->ior == b->ior;
+					if (!strcmp(o->path, sm.path) && same && o->albedo.x == sm.albedo.x
+						&& o->albedo.y == sm.albedo.y && o->albedo.z == sm.albedo.z) break;
+				}
+				if (i == n_meshes) {
+					if (n_meshes == mesh_cap) {
+						mesh_cap *= 2;
+						meshes = (SceneMesh *)realloc(meshes, mesh_cap * sizeof(SceneMesh));
+					}
+					meshes[n_meshes++] = sm;
+				}
+				if (n_places == place_cap) {
+					place_cap *= 2;
+					places = (ScenePlacement *)realloc(places, place_cap * sizeof(ScenePlacement));
+				}
+				p.mesh = i;
+				places[n_places++] = p;
+			}
+		} else {
+			ret = -1;
+		}
+		if (ret < 0) printf("%s:%d: could not parse '%s' line\n", fname, ln, key);
+	}
+	fclose(f);
+	if (ret < 0) {
+		free(meshes);
+		free(places);
+		free_setup(setup);
+		return -1;
+	}
+	//with keys but no count, the sequence runs to the last key
+	if (frames == 0 && setup->n_keys > 0) frames = setup->keys[setup->n_keys - 1].frame + 1;
+	setup->frames = frames > 0 ? frames : 1;
+
+	//prototypes are created here so object ids follow the file
+	MeshOrder * order = (MeshOrder *)malloc((n_meshes > 0 ? n_meshes : 1) * sizeof(MeshOrder));
+	for (int i = 0; i < n_meshes; i++) {
+		SceneMesh * sm = &meshes[i];
+		sm->mesh = new RTTriangleMesh(s, sm->material, emit_black, true);
+		sm->mesh->albedo = sm->albedo;
+		sm->mesh->use_cache = use_cache;
+		struct stat st;
+		order[i].size = stat(sm->path, &st) == 0 ? st.st_size : 0;
+		order[i].mesh = i;
+	}
+	qsort(order, n_meshes, sizeof(MeshOrder), by_size);
+
+	//the loader threads share the cores out evenly
+	int cores = std::thread::hardware_concurrency();
+	if (n_threads < 1) n_threads = 1;
+	if (n_threads > n_meshes) n_threads = n_meshes;
+	int k = cores / (n_threads > 0 ? n_threads : 1);
+	for (int i = 0; i < n_meshes; i++) {
+		meshes[i].mesh->parse_threads = k > 1 ? k : 1;
+	}
+
+	long b0 = s->device_bytes;
+	std::atomic<int> next(0), failed(0);
+	std::thread * pool = new std::thread[n_threads];
+	for (int i = 0; i < n_threads; i++) {
+		pool[i] = std::thread(load_worker, meshes, order, n_meshes, &next, &failed);
+	}
+
+	//the sky loads while the meshes do
+	double t0 = wall_time();
+	if (sky_size > 0.f) {
+		setup->sky = new RTSkyBox(s, sky_size, vec3f(0.f, 0.f, 0.f));
+		if (setup->sky->loadFile(sky_names[0], sky_names[1], sky_names[2]) < 0) failed++;
+	}
+	if (env_name[0] && s->set_hdri(env_name, env_rotation, env_intensity) < 0) failed++;
+	setup->texture_seconds = wall_time() - t0;
+
+	for (int i = 0; i < n_threads; i++) {
+		pool[i].join();
+	}
+	delete[] pool;
+	//per-geometry counts overlap when loads run side by side
+	s->geom_bytes = s->device_bytes - b0;
+
+	if (failed == 0) {
+		for (int i = 0; i < n_places; i++) {
+			ScenePlacement * p = &places[i];
+			RTInstance * inst = new RTInstance(s, meshes[p->mesh].mesh, p->m, p->t);
+			if (inst->id < 0) {
+				delete inst;
+				failed++;
+				break;
+			}
+			if (p->spin == 0.f && p->drift.x == 0.f && p->drift.y == 0.f && p->drift.z == 0.f) continue;
+			setup->moving = (SceneMotion *)realloc(setup->moving, (setup->n_moving + 1) * sizeof(SceneMotion));
+			SceneMotion * sm = &setup->moving[setup->n_moving++];
+			sm->inst = inst;
+			sm->m = p->m;
+			sm->t = p->t;
+			sm->axis = p->axis;
+			sm->spin = p->spin;
+			sm->drift = p->drift;
+		}
+	}
+	setup->n_meshes = n_meshes;
+	setup->n_placements = n_places;
+	setup->load_seconds = wall_time() - start;
+
+	free(order);
+	free(meshes);
+	free(places);
+	return failed == 0 ? 0 : -1;
+}
+
+int scene_inputs(char * fname, void (*f)(const char * path, void * arg), void * arg) {
+	FILE * in = fopen(fname, "r");
+	if (!in) return -1;
+	char line[8192], path[4096];
+	while (fgets(line, sizeof(line), in)) {
+		char * key = strtok(line, " \t\r\n");
+		if (!key) continue;
+		int n = 0;
+		if (!strcmp(key, "mesh") || !strcmp(key, "environment")) n = 1;
+		else if (!strcmp(key, "skybox")) n = 3;
+		for (int i = 0; i < n; i++) {
+			char * name = strtok(NULL, " \t\r\n");
+			if (!name) break;
+			resolve(fname, name, path, sizeof(path));
+			f(path, arg);
+		}
+	}
+	fclose(in);
+	return 0;
+}
+
+void setup_camera(RTScene * s, const SceneSetup * setup, int frame) {
+	vec3f eye = setup->eye, dir = setup->dir;
+	float fov = setup->fov;
+	int n = setup->n_keys;
+	const CameraKey * k = setup->keys;
+	if (n > 0) {
+		//held before the first key and after the last
+		int i = 0;
+		while (i < n && k[i].frame <= frame) i++;
+		if (i == 0 || i == n) {
+			const CameraKey * c = &k[i == 0 ? 0 : n - 1];
+			eye = c->eye; dir = c->dir; fov = c->fov;
+		} else {
+			const CameraKey * a = &k[i - 1], * b = &k[i];
+			float f = (float)(frame - a->frame) / (float)(b->frame - a->frame);
+			eye = a->eye * (1.f - f) + b->eye * f;
+			dir = a->dir.normalized() * (1.f - f) + b->dir.normalized() * f;
+			fov = a->fov * (1.f - f) + b->fov * f;
+		}
+	}
+	s->move(eye.x, eye.y, eye.z);
+	s->point(dir.x, dir.y, dir.z);
+	s->zoom(fov);
+}
+
+void setup_frame(RTScene * s, const SceneSetup * setup, int frame) {
+	setup_camera(s, setup, frame);
+
+	//only the instance's transform changes; its prototype keeps its BVH
+	for (int i = 0; i < setup->n_moving; i++) {
+		const SceneMotion * sm = &setup->moving[i];
+		matrix3f r = rotation(sm->spin * frame, sm->axis);
+		sm->inst->setTransform(r * sm->m, sm->t + sm->drift * (float)frame);
+		rtcCommitGeometry(sm->inst->geom);
+	}
+}
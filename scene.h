@@ -0,0 +1,72 @@
+#ifndef __SCENE_H
+#define __SCENE_H
+
+#include "geom.h"
+#include "RTObject.h"
+
+#define SCENE_EXT ".scene"
+
+//the camera at one frame of a sequence; frames between keys blend
+//the two around them
+typedef struct {
+	int frame;
+	vec3f eye, dir;
+	float fov;
+} CameraKey;
+
+//a placement that moves from frame to frame: it turns spin radians a
+//frame about its own origin and drifts that far, on top of m and t
+typedef struct {
+	RTInstance * inst;
+	matrix3f m;
+	vec3f t;
+	int axis;
+	float spin;
+	vec3f drift;
+} SceneMotion;
+
+//what a scene file sets besides the geometry it loads
+typedef struct {
+	int width, height;
+	vec3f eye, dir;
+	float fov;
+	//NULL when the scene is lit by an environment instead
+	RTSkyBox * sky;
+	int n_meshes, n_placements;
+	//from opening the file to the last mesh's BVH
+	double load_seconds;
+	//of that, reading the sky or environment (alongside the meshes)
+	double texture_seconds;
+	//a sequence of frames (1 for a still), its camera path and the
+	//placements that move; both lists are malloc'd, or NULL
+	int frames;
+	int n_keys, n_moving;
+	CameraKey * keys;
+	SceneMotion * moving;
+} SceneSetup;
+
+//the camera and output main() used before there were scene files
+void default_setup(SceneSetup * setup);
+
+void free_setup(SceneSetup * setup);
+
+//true if fname ends in the scene file extension
+bool is_scene_file(char * fname);
+
+//reads a scene file and loads what it names into s; meshes are read
+//and built on n_threads threads. the caller commits the scene
+int load_scene(RTScene * s, char * fname, SceneSetup * setup, int n_threads, bool use_cache);
+
+//calls f with each file a scene file names (meshes, skybox faces,
+//environment), resolved as load_scene resolves them; -1 if the scene
+//file can't be read
+int scene_inputs(char * fname, void (*f)(const char * path, void * arg), void * arg);
+
+//points the camera as the path has it at frame
+void setup_camera(RTScene * s, const SceneSetup * setup, int frame);
+
+//setup_camera, and moves the moving placements to frame; the caller
+//commits the scene if any moved
+void setup_frame(RTScene * s, const SceneSetup * setup, int frame);
+
+#endif
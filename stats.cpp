@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "stats.h"
+
+static const char * counter_names[STAT_COUNTERS] = {
+	"primary_rays", "gi_rays", "shadow_rays", "primary_misses", "gi_misses", "shadowed",
+	"sky_shortcuts", "roulette_kills", "color_calls", "bsdf_samples", "emit_calls", "env_lookups", "tiles",
+};
+
+static const char * timer_names[STAT_TIMERS] = {
+	"primary", "gi", "shadow", "color", "bsdf", "emit", "tile", "write",
+};
+
+//every block, kept until the report. workers are spawned afresh for
+//each render, so a thread that exits leaves its block on the spare
+//list for the next one: there are as many blocks as threads ever ran
+//at once, and each sums the threads that held it
+static std::mutex blocks_lock;
+static StatsBlock ** blocks = NULL;
+static StatsBlock ** spare = NULL;
+static int n_blocks = 0, n_spare = 0, blocks_cap = 0;
+
+class StatsOwner {
+public:
+	StatsOwner() : block(NULL) {}
+	~StatsOwner() {
+		if (!block) return;
+		blocks_lock.lock();
+		spare[n_spare++] = block;
+		blocks_lock.unlock();
+	}
+public:
+	StatsBlock * block;
+};
+
+static thread_local StatsOwner local;
+
+static char * report_name = NULL;
+
+static uint64_t steady_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t stats_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return steady_ns();
+#endif
+}
+
+//ticks are turned into seconds against the steady clock over the run
+static uint64_t start_ticks = stats_ticks(), start_ns = steady_ns();
+
+double stats_tick_seconds() {
+	uint64_t ticks = stats_ticks() - start_ticks;
+	return ticks > 0 ? (steady_ns() - start_ns) * 1e-9 / ticks : 0.0;
+}
+
+StatsBlock * stats_block() {
+	if (local.block) return local.block;
+	blocks_lock.lock();
+	if (n_spare > 0) {
+		local.block = spare[--n_spare];
+	} else {
+		if (n_blocks == blocks_cap) {
+			blocks_cap = blocks_cap ? 2 * blocks_cap : 64;
+			blocks = (StatsBlock **)realloc(blocks, blocks_cap * sizeof(StatsBlock *));
+			spare = (StatsBlock **)realloc(spare, blocks_cap * sizeof(StatsBlock *));
+		}
+		local.block = (StatsBlock *)aligned_alloc(64, sizeof(StatsBlock));
+		memset(local.block, 0, sizeof(StatsBlock));
+		blocks[n_blocks++] = local.block;
+	}
+	blocks_lock.unlock();
+	return local.block;
+}
+
+#ifdef RT_STATS
+static void write_report() {
+	double seconds = (steady_ns() - start_ns) * 1e-9;
+	double tick = stats_tick_seconds();
+
+	StatsBlock sum;
+	memset(&sum, 0, sizeof(sum));
+	blocks_lock.lock();
+	for (int i = 0; i < n_blocks; i++) {
+		StatsBlock * b = blocks[i];
+		for (int c = 0; c < STAT_COUNTERS; c++) sum.count[c] += b->count[c];
+		for (int t = 0; t < STAT_TIMERS; t++) {
+			sum.ticks[t] += b->ticks[t];
+			sum.calls[t] += b->calls[t];
+		}
+		for (int h = 0; h < STATS_MAX_OBJECTS; h++) sum.hits[h] += b->hits[h];
+	}
+
+	FILE * f = fopen(report_name, "w");
+	if (!f) {
+		blocks_lock.unlock();
+		printf("Could not write %s\n", report_name);
+		return;
+	}
+	size_t len = strlen(report_name);
+	if (len >= 4 && !strcmp(report_name + len - 4, ".csv")) {
+		fprintf(f, "kind,name,count,seconds\n");
+		for (int c = 0; c < STAT_COUNTERS; c++) {
+			fprintf(f, "counter,%s,%llu,\n", counter_names[c], (unsigned long long)sum.count[c]);
+		}
+		for (int t = 0; t < STAT_TIMERS; t++) {
+			fprintf(f, "timer,%s,%llu,%.6f\n", timer_names[t], (unsigned long long)sum.calls[t], sum.ticks[t] * tick);
+		}
+		for (int h = 0; h < STATS_MAX_OBJECTS; h++) {
+			if (sum.hits[h]) fprintf(f, "hits,%d,%llu,\n", h, (unsigned long long)sum.hits[h]);
+		}
+		for (int i = 0; i < n_blocks; i++) {
+			uint64_t rays = blocks[i]->count[STAT_PRIMARY_RAYS] + blocks[i]->count[STAT_GI_RAYS] + blocks[i]->count[STAT_SHADOW_RAYS];
+			fprintf(f, "thread_rays,%d,%llu,\n", i, (unsigned long long)rays);
+		}
+	} else {
+		fprintf(f, "{\n  \"seconds\": %.6f,\n  \"threads\": %d,\n  \"counters\": {", seconds, n_blocks);
+		for (int c = 0; c < STAT_COUNTERS; c++) {
+			fprintf(f, "%s\n    \"%s\": %llu", c ? "," : "", counter_names[c], (unsigned long long)sum.count[c]);
+		}
+		//timers nest: tile time includes the ray and shading timers
+		fprintf(f, "\n  },\n  \"timers\": {");
+		for (int t = 0; t < STAT_TIMERS; t++) {
+			double s = sum.ticks[t] * tick;
+			fprintf(f, "%s\n    \"%s\": {\"calls\": %llu, \"seconds\": %.6f, \"ns_per_call\": %.1f}", t ? "," : "",
+				timer_names[t], (unsigned long long)sum.calls[t], s, sum.calls[t] ? s / sum.calls[t] * 1e9 : 0.0);
+		}
+		fprintf(f, "\n  },\n  \"hits\": {");
+		bool first = true;
+		for (int h = 0; h < STATS_MAX_OBJECTS; h++) {
+			if (!sum.hits[h]) continue;
+			fprintf(f, "%s\n    \"%d\": %llu", first ? "" : ",", h, (unsigned long long)sum.hits[h]);
+			first = false;
+		}
+		//rays per thread show how evenly the tiles were shared
+		fprintf(f, "\n  },\n  \"thread_rays\": [");
+		for (int i = 0; i < n_blocks; i++) {
+			uint64_t rays = blocks[i]->count[STAT_PRIMARY_RAYS] + blocks[i]->count[STAT_GI_RAYS] + blocks[i]->count[STAT_SHADOW_RAYS];
+			fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)rays);
+		}
+		fprintf(f, "]\n}\n");
+	}
+	blocks_lock.unlock();
+	if (fclose(f) != 0) printf("Could not write %s\n", report_name);
+}
+#endif
+
+int stats_report_at_exit(char * fname) {
+#ifdef RT_STATS
+	if (!report_name) atexit(write_report);
+	report_name = fname;
+	return 0;
+#else
+	printf("This build has no instrumentation; rebuild with make STATS=1\n");
+	return -1;
+#endif
+}
@@ -0,0 +1,110 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdint.h>
+
+//hot path instrumentation: per-thread event counters, hits per object
+//and scoped timers, summed over threads into a report at exit. it
+//costs nothing unless built with RT_STATS (make STATS=1); the macros
+//below then expand to nothing
+
+enum {
+	STAT_PRIMARY_RAYS,
+	STAT_GI_RAYS,
+	STAT_SHADOW_RAYS,
+	STAT_PRIMARY_MISSES,
+	STAT_GI_MISSES,
+	STAT_SHADOWED,
+	STAT_SKY_SHORTCUTS, //camera hits on surfaces that don't scatter
+	STAT_ROULETTE_KILLS,
+	STAT_COLOR_CALLS,   //batch calls count each hit
+	STAT_BSDF_SAMPLES,  //bounces off anything but lambert surfaces
+	STAT_EMIT_CALLS,
+	STAT_ENV_LOOKUPS,
+	STAT_TILES,
+	STAT_COUNTERS
+};
+
+enum {
+	TIMER_PRIMARY, //camera rays and packets
+	TIMER_GI,      //GI rays and streams
+	TIMER_SHADOW,  //shadow rays and streams
+	TIMER_COLOR,
+	TIMER_BSDF,
+	TIMER_EMIT,
+	TIMER_TILE,    //whole tiles, shading included
+	TIMER_WRITE,
+	STAT_TIMERS
+};
+
+//hits on objects past this share the last slot
+#define STATS_MAX_OBJECTS 256
+
+//one per thread, on its own cache lines so counting never shares
+//a line with another thread
+struct alignas(64) StatsBlock {
+	uint64_t count[STAT_COUNTERS];
+	uint64_t ticks[STAT_TIMERS];
+	uint64_t calls[STAT_TIMERS];
+	uint64_t hits[STATS_MAX_OBJECTS];
+};
+
+//the calling thread's block, made on first use or taken over from a
+//thread that has exited
+StatsBlock * stats_block();
+//rdtsc where there is one, else steady_clock nanoseconds
+uint64_t stats_ticks();
+//seconds per tick, measured since start-up
+double stats_tick_seconds();
+
+//writes the sums to fname at exit, as CSV if it ends in .csv and as
+//JSON otherwise. returns -1 when the build has no instrumentation
+int stats_report_at_exit(char * fname);
+
+#define STATS_CAT2(a, b) a##b
+#define STATS_CAT(a, b) STATS_CAT2(a, b)
+
+#ifdef RT_STATS
+
+#define STATS_ON true
+
+inline void stats_time(int t, uint64_t ticks) {
+	StatsBlock * b = stats_block();
+	b->ticks[t] += ticks;
+	b->calls[t]++;
+}
+
+class StatsTimer {
+public:
+	StatsTimer(int t) : timer(t), start(stats_ticks()) {}
+	~StatsTimer() {stats_time(timer, stats_ticks() - start);}
+private:
+	int timer;
+	uint64_t start;
+};
+
+inline void stats_hit(unsigned int id) {
+	stats_block()->hits[id < STATS_MAX_OBJECTS ? id : STATS_MAX_OBJECTS - 1]++;
+}
+
+#define STAT_ADD(c, n) (stats_block()->count[c] += (n))
+#define STAT_INC(c) STAT_ADD(c, 1)
+#define STAT_HIT(id) stats_hit(id)
+//adds ticks measured elsewhere to timer t, as one call
+#define STAT_TIME(t, ticks) stats_time(t, ticks)
+//times the rest of the enclosing scope
+#define STAT_TIMER(t) StatsTimer STATS_CAT(stat_timer_, __LINE__)(t)
+
+#else
+
+#define STATS_ON false
+
+#define STAT_ADD(c, n) ((void)0)
+#define STAT_INC(c) ((void)0)
+#define STAT_HIT(id) ((void)0)
+#define STAT_TIME(t, ticks) ((void)0)
+#define STAT_TIMER(t) ((void)0)
+
+#endif
+
+#endif
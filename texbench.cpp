@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geom.h"
+#include "bmp.h"
+#include "rng.h"
+#include "texture.h"
+
+#define N_COORDS (1 << 22)
+#define N_ROUNDS 8
+
+//the lookup RTSkyBox used to do: three planar byte arrays, nearest
+typedef struct {
+	int w, h;
+	unsigned char *red, *green, *blue;
+} Planar;
+
+inline vec3f planar_lookup(const Planar * p, float s, float t) {
+	int x = (int)(s * p->w), y = (int)(t * p->h);
+	if (x >= p->w) x = p->w - 1;
+	if (y >= p->h) y = p->h - 1;
+	int i = y * p->w + x;
+	return vec3f((float)p->red[i] / 255.f, (float)p->green[i] / 255.f, (float)p->blue[i] / 255.f);
+}
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+enum {
+	BENCH_PLANAR,
+	BENCH_NEAREST,
+	BENCH_BILINEAR,
+	BENCH_TRILINEAR,
+};
+
+//lookups per second over the coordinate list
+double bench(int kind, const Planar * p, const Texture * t, const float * s, const float * u, float footprint) {
+	vec3f sum(0.f, 0.f, 0.f);
+	double start = now();
+	for (int r = 0; r < N_ROUNDS; r++) {
+		for (int i = 0; i < N_COORDS; i++) {
+			switch (kind) {
+			case BENCH_PLANAR: sum += planar_lookup(p, s[i], u[i]); break;
+			case BENCH_NEAREST: sum += t->nearest(s[i], u[i]); break;
+			case BENCH_BILINEAR: sum += t->bilinear(s[i], u[i], 0); break;
+			default: sum += t->lookup(s[i], u[i], footprint); break;
+			}
+		}
+	}
+	double secs = now() - start;
+	//keep the loop from being optimised away
+	if (sum.x == -1.f) printf("%f\n", sum.y);
+	return (double)N_ROUNDS * N_COORDS / secs;
+}
+
+//texture lookup throughput: the old planar layout against Texture's
+//row and tiled layouts, for camera-like and GI-like access
+int main(int argc, char** argv) {
+	char * fname = argc > 1 ? argv[1] : (char*)"textures/bliss.bmp";
+
+	Texture linear, tiled;
+	if (linear.load_bmp(fname, TEX_LINEAR) < 0 || tiled.load_bmp(fname, TEX_TILED) < 0) return -1;
+	int w = tiled.width, h = tiled.height;
+
+	Planar p;
+	p.w = w; p.h = h;
+	p.red = (unsigned char *)malloc(w * h);
+	p.green = (unsigned char *)malloc(w * h);
+	p.blue = (unsigned char *)malloc(w * h);
+	read_bmp(p.red, p.green, p.blue, w, h, fname);
+
+	//coherent: a camera sweeping rows across the texture, a bit
+	//magnified; random: GI hits landing anywhere
+	float * cs = (float *)malloc(N_COORDS * sizeof(float));
+	float * ct = (float *)malloc(N_COORDS * sizeof(float));
+	float * rs = (float *)malloc(N_COORDS * sizeof(float));
+	float * rt = (float *)malloc(N_COORDS * sizeof(float));
+	int side = 2048;
+	RNG rng(1, 0);
+	for (int i = 0; i < N_COORDS; i++) {
+		cs[i] = (float)(i % side) / side;
+		ct[i] = (float)(i / side % side) / side;
+		rs[i] = rng.uniform();
+		rt[i] = rng.uniform();
+	}
+
+	printf("%s: %dx%d, %d levels, %.1f MB tiled with mips\n", fname, w, h, tiled.n_levels, tiled.bytes / 1048576.0);
+	printf("%-28s %12s %12s\n", "Mlookups/s", "coherent", "random");
+	printf("%-28s %12.1f %12.1f\n", "planar, nearest",
+		bench(BENCH_PLANAR, &p, NULL, cs, ct, 0.f) * 1e-6, bench(BENCH_PLANAR, &p, NULL, rs, rt, 0.f) * 1e-6);
+	printf("%-28s %12.1f %12.1f\n", "rows, nearest",
+		bench(BENCH_NEAREST, NULL, &linear, cs, ct, 0.f) * 1e-6, bench(BENCH_NEAREST, NULL, &linear, rs, rt, 0.f) * 1e-6);
+	printf("%-28s %12.1f %12.1f\n", "tiled, nearest",
+		bench(BENCH_NEAREST, NULL, &tiled, cs, ct, 0.f) * 1e-6, bench(BENCH_NEAREST, NULL, &tiled, rs, rt, 0.f) * 1e-6);
+	printf("%-28s %12.1f %12.1f\n", "rows, bilinear",
+		bench(BENCH_BILINEAR, NULL, &linear, cs, ct, 0.f) * 1e-6, bench(BENCH_BILINEAR, NULL, &linear, rs, rt, 0.f) * 1e-6);
+	printf("%-28s %12.1f %12.1f\n", "tiled, bilinear",
+		bench(BENCH_BILINEAR, NULL, &tiled, cs, ct, 0.f) * 1e-6, bench(BENCH_BILINEAR, NULL, &tiled, rs, rt, 0.f) * 1e-6);
+	printf("%-28s %12.1f %12.1f\n", "tiled, trilinear 8 texels",
+		bench(BENCH_TRILINEAR, NULL, &tiled, cs, ct, 8.f) * 1e-6, bench(BENCH_TRILINEAR, NULL, &tiled, rs, rt, 8.f) * 1e-6);
+	printf("%-28s %12.1f %12.1f\n", "tiled, trilinear 64 texels",
+		bench(BENCH_TRILINEAR, NULL, &tiled, cs, ct, 64.f) * 1e-6, bench(BENCH_TRILINEAR, NULL, &tiled, rs, rt, 64.f) * 1e-6);
+
+	free(p.red); free(p.green); free(p.blue);
+	free(cs); free(ct); free(rs); free(rt);
+	return 0;
+}
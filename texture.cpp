@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "texture.h"
+
+Texture::Texture() {
+	width = height = 0;
+	format = TEX_RGBA8;
+	layout = TEX_TILED;
+	filter = TEX_TRILINEAR;
+	n_levels = 0;
+	bytes = 0;
+	levels = NULL;
+}
+
+Texture::~Texture() {
+	release();
+}
+
+void Texture::release() {
+	for (int i = 0; i < n_levels; i++) free(levels[i].data);
+	free(levels);
+	levels = NULL;
+	n_levels = 0;
+	bytes = 0;
+}
+
+inline int texel_size(int fmt) {
+	return fmt == TEX_RGBA8 ? 4 : 4 * sizeof(float);
+}
+
+//allocates the whole chain; only the top level is meaningful until
+//build_mips()
+int Texture::init(int w, int h, int fmt, int lay) {
+	release();
+	if (w < 1 || h < 1 || w > TEX_MAX_SIZE || h > TEX_MAX_SIZE) return -1;
+	width = w; height = h;
+	format = fmt; layout = lay;
+
+	int n = 1;
+	for (int m = w > h ? w : h; m > 1; m >>= 1) n++;
+	levels = (TexLevel *)malloc(n * sizeof(TexLevel));
+	if (!levels) return -1;
+
+	//n_levels counts the levels allocated so far, so a failure
+	//part way through releases just those
+	for (int i = 0; i < n; i++) {
+		TexLevel * l = &levels[i];
+		l->width = w; l->height = h;
+		l->pw = (w + TEX_BLOCK - 1) / TEX_BLOCK * TEX_BLOCK;
+		l->ph = (h + TEX_BLOCK - 1) / TEX_BLOCK * TEX_BLOCK;
+		size_t size = (size_t)l->pw * l->ph * texel_size(fmt);
+		//a block is a cache line, so keep blocks on line boundaries
+		l->data = aligned_alloc(64, (size + 63) & ~(size_t)63);
+		if (!l->data) {
+			release();
+			return -1;
+		}
+		n_levels = i + 1;
+		memset(l->data, 0, size);
+		bytes += size;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	return 0;
+}
+
+//sizes from a file header are checked before anything is sized by them
+static bool bad_size(char * fname, int w, int h) {
+	if (w >= 1 && h >= 1 && w <= TEX_MAX_SIZE && h <= TEX_MAX_SIZE) return false;
+	printf("%s is %dx%d, outside 1 to %d texels a side\n", fname, w, h, TEX_MAX_SIZE);
+	return true;
+}
+
+//24 bit uncompressed BMP; row 0 is the first row in the file, as
+//read_bmp() has it
+int Texture::load_bmp(char * fname, int lay) {
+	FILE * f = fopen(fname, "rb");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+	unsigned char h[54];
+	if (fread(h, 1, 54, f) != 54 || h[0] != 'B' || h[1] != 'M' || h[28] != 24) {
+		printf("%s is not a 24 bit BMP\n", fname);
+		fclose(f);
+		return -1;
+	}
+	int offs = h[10] | h[11] << 8 | h[12] << 16 | h[13] << 24;
+	int w = h[18] | h[19] << 8 | h[20] << 16 | h[21] << 24;
+	int ht = h[22] | h[23] << 8 | h[24] << 16 | h[25] << 24;
+	if (ht < 0 && ht >= -TEX_MAX_SIZE) ht = -ht;
+	if (bad_size(fname, w, ht) || init(w, ht, TEX_RGBA8, lay) < 0) {
+		fclose(f);
+		return -1;
+	}
+
+	size_t stride = ((size_t)w * 3 + 3) & ~(size_t)3;
+	unsigned char * row = (unsigned char *)malloc(stride);
+	if (!row || fseek(f, offs, SEEK_SET) != 0) {
+		printf("Could not read %s\n", fname);
+		free(row);
+		fclose(f);
+		return -1;
+	}
+	for (int y = 0; y < ht; y++) {
+		if (fread(row, 1, stride, f) != stride) {
+			printf("%s is truncated\n", fname);
+			free(row);
+			fclose(f);
+			return -1;
+		}
+		unsigned char * t = (unsigned char *)levels[0].data;
+		for (int x = 0; x < w; x++) {
+			unsigned char * p = t + 4 * offset(&levels[0], x, y);
+			p[0] = row[3 * x + 2]; p[1] = row[3 * x + 1]; p[2] = row[3 * x]; p[3] = 255;
+		}
+	}
+	free(row);
+	fclose(f);
+	build_mips();
+	return 0;
+}
+
+//one RGBE scanline, either flat or in the new run-length form where
+//each of the four channels is coded separately
+static int read_rgbe(FILE * f, unsigned char * row, int w) {
+	int c0 = getc(f), c1 = getc(f), c2 = getc(f), c3 = getc(f);
+	if (c3 == EOF) return -1;
+	if (w < 8 || w > 0x7fff || c0 != 2 || c1 != 2 || (c2 & 0x80)) {
+		row[0] = c0; row[1] = c1; row[2] = c2; row[3] = c3;
+		return fread(row + 4, 4, w - 1, f) == (size_t)(w - 1) ? 0 : -1;
+	}
+	if ((c2 << 8 | c3) != w) return -1;
+	for (int c = 0; c < 4; c++) {
+		for (int x = 0; x < w;) {
+			int n = getc(f);
+			if (n == EOF) return -1;
+			if (n > 128) {
+				n -= 128;
+				int v = getc(f);
+				if (v == EOF || x + n > w) return -1;
+				for (; n > 0; n--) row[4 * x++ + c] = v;
+			} else {
+				if (n == 0 || x + n > w) return -1;
+				for (; n > 0; n--) {
+					int v = getc(f);
+					if (v == EOF) return -1;
+					row[4 * x++ + c] = v;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+//Radiance .hdr with the usual -Y h +X w orientation, into float texels
+int Texture::load_hdr(char * fname, int lay) {
+	FILE * f = fopen(fname, "rb");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+	char line[256];
+	if (!fgets(line, sizeof(line), f) || line[0] != '#' || line[1] != '?') {
+		printf("%s is not a Radiance HDR file\n", fname);
+		fclose(f);
+		return -1;
+	}
+	//header lines up to a blank one, then the resolution
+	while (fgets(line, sizeof(line), f) && line[0] != '\n') {
+		if (!strncmp(line, "FORMAT=", 7) && strncmp(line + 7, "32-bit_rle_rgbe", 15)) {
+			printf("%s is not in RGBE format\n", fname);
+			fclose(f);
+			return -1;
+		}
+	}
+	int w, h;
+	if (!fgets(line, sizeof(line), f) || sscanf(line, "-Y %d +X %d", &h, &w) != 2) {
+		printf("%s has an unsupported resolution line\n", fname);
+		fclose(f);
+		return -1;
+	}
+	if (bad_size(fname, w, h) || init(w, h, TEX_RGBA32F, lay) < 0) {
+		fclose(f);
+		return -1;
+	}
+
+	unsigned char * row = (unsigned char *)malloc(4 * (size_t)w);
+	if (!row) {
+		printf("Could not read %s\n", fname);
+		fclose(f);
+		return -1;
+	}
+	for (int y = 0; y < h; y++) {
+		if (read_rgbe(f, row, w) < 0) {
+			printf("%s is truncated\n", fname);
+			free(row);
+			fclose(f);
+			return -1;
+		}
+		for (int x = 0; x < w; x++) {
+			unsigned char * p = row + 4 * x;
+			float m = p[3] ? ldexpf(1.f, p[3] - (128 + 8)) : 0.f;
+			set(x, y, vec3f(p[0] * m, p[1] * m, p[2] * m));
+		}
+	}
+	free(row);
+	fclose(f);
+	build_mips();
+	return 0;
+}
+
+//portable float map, colour (PF) or grey (Pf). rows are stored bottom
+//up and flipped here so row 0 is the top, as for the other formats
+int Texture::load_pfm(char * fname, int lay) {
+	FILE * f = fopen(fname, "rb");
+	if (!f) {
+		printf("Could not open %s\n", fname);
+		return -1;
+	}
+	char kind[3] = {0, 0, 0};
+	int w, h;
+	float scale;
+	if (fscanf(f, "%2s %d %d %f", kind, &w, &h, &scale) != 4 || kind[0] != 'P' || (kind[1] != 'F' && kind[1] != 'f')
+			|| fgetc(f) == EOF) {
+		printf("%s is not a PFM file\n", fname);
+		fclose(f);
+		return -1;
+	}
+	if (bad_size(fname, w, h) || init(w, h, TEX_RGBA32F, lay) < 0) {
+		fclose(f);
+		return -1;
+	}
+	int nc = kind[1] == 'F' ? 3 : 1;
+	//the sign of the scale gives the byte order, negative is little endian
+	uint16_t one = 1;
+	bool swap = (scale < 0.f) != (*(unsigned char *)&one == 1);
+
+	float * row = (float *)malloc((size_t)w * nc * sizeof(float));
+	if (!row) {
+		printf("Could not read %s\n", fname);
+		fclose(f);
+		return -1;
+	}
+	for (int y = h - 1; y >= 0; y--) {
+		if (fread(row, sizeof(float) * nc, w, f) != (size_t)w) {
+			printf("%s is truncated\n", fname);
+			free(row);
+			fclose(f);
+			return -1;
+		}
+		if (swap) {
+			uint32_t * r = (uint32_t *)row;
+			for (size_t i = 0; i < (size_t)w * nc; i++) r[i] = __builtin_bswap32(r[i]);
+		}
+		for (int x = 0; x < w; x++) {
+			float * p = row + nc * x;
+			set(x, y, nc == 3 ? vec3f(p[0], p[1], p[2]) : vec3f(p[0], p[0], p[0]));
+		}
+	}
+	free(row);
+	fclose(f);
+	build_mips();
+	return 0;
+}
+
+void Texture::set(int x, int y, const vec3f & c) {
+	size_t i = offset(&levels[0], x, y);
+	if (format == TEX_RGBA8) {
+		unsigned char * p = (unsigned char *)levels[0].data + 4 * i;
+		p[0] = (unsigned char)fminf(fmaxf(c.x * 255.f + 0.5f, 0.f), 255.f);
+		p[1] = (unsigned char)fminf(fmaxf(c.y * 255.f + 0.5f, 0.f), 255.f);
+		p[2] = (unsigned char)fminf(fmaxf(c.z * 255.f + 0.5f, 0.f), 255.f);
+		p[3] = 255;
+	} else {
+		float * p = (float *)levels[0].data + 4 * i;
+		p[0] = c.x; p[1] = c.y; p[2] = c.z; p[3] = 1.f;
+	}
+}
+
+//2x2 box filter, clamped at odd edges
+void Texture::build_mips() {
+	for (int i = 1; i < n_levels; i++) {
+		TexLevel * src = &levels[i - 1];
+		TexLevel * dst = &levels[i];
+		for (int y = 0; y < dst->height; y++) {
+			for (int x = 0; x < dst->width; x++) {
+				int x0 = 2 * x, y0 = 2 * y;
+				int x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+				int y1 = y0 + 1 < src->height ? y0 + 1 : y0;
+				vec3f c = (texel(i - 1, x0, y0) + texel(i - 1, x1, y0) + texel(i - 1, x0, y1) + texel(i - 1, x1, y1)) * 0.25f;
+				size_t k = offset(dst, x, y);
+				if (format == TEX_RGBA8) {
+					unsigned char * p = (unsigned char *)dst->data + 4 * k;
+					p[0] = (unsigned char)(c.x * 255.f + 0.5f);
+					p[1] = (unsigned char)(c.y * 255.f + 0.5f);
+					p[2] = (unsigned char)(c.z * 255.f + 0.5f);
+					p[3] = 255;
+				} else {
+					float * p = (float *)dst->data + 4 * k;
+					p[0] = c.x; p[1] = c.y; p[2] = c.z; p[3] = 1.f;
+				}
+			}
+		}
+	}
+}
+
+vec3f Texture::texel(int level, int x, int y) const {
+	const TexLevel * l = &levels[level];
+	size_t i = offset(l, x, y);
+	if (format == TEX_RGBA8) {
+		const unsigned char * p = (const unsigned char *)l->data + 4 * i;
+		return vec3f(p[0], p[1], p[2]) * (1.f / 255.f);
+	}
+	const float * p = (const float *)l->data + 4 * i;
+	return vec3f(p[0], p[1], p[2]);
+}
+
+inline int clampi(int x, int lo, int hi) {
+	return x < lo ? lo : (x > hi ? hi : x);
+}
+
+vec3f Texture::nearest(float s, float t) const {
+	int x = clampi((int)(s * width), 0, width - 1);
+	int y = clampi((int)(t * height), 0, height - 1);
+	return texel(0, x, y);
+}
+
+//texel centres are at (i + 0.5) / size
+vec3f Texture::bilinear(float s, float t, int level) const {
+	const TexLevel * l = &levels[level];
+	float fx = s * l->width - 0.5f, fy = t * l->height - 0.5f;
+	float ix = floorf(fx), iy = floorf(fy);
+	float ax = fx - ix, ay = fy - iy;
+	int x0 = clampi((int)ix, 0, l->width - 1), x1 = clampi((int)ix + 1, 0, l->width - 1);
+	int y0 = clampi((int)iy, 0, l->height - 1), y1 = clampi((int)iy + 1, 0, l->height - 1);
+	vec3f a = texel(level, x0, y0) * (1.f - ax) + texel(level, x1, y0) * ax;
+	vec3f b = texel(level, x0, y1) * (1.f - ax) + texel(level, x1, y1) * ax;
+	return a * (1.f - ay) + b * ay;
+}
+
+vec3f Texture::lookup(float s, float t, float footprint) const {
+	if (filter == TEX_NEAREST) return nearest(s, t);
+
+	float lod = footprint > 1.f ? log2f(footprint) : 0.f;
+	if (lod >= n_levels - 1) return average();
+	if (filter == TEX_BILINEAR) return bilinear(s, t, (int)(lod + 0.5f));
+
+	int l0 = (int)lod;
+	float a = lod - l0;
+	if (a == 0.f) return bilinear(s, t, l0);
+	return bilinear(s, t, l0) * (1.f - a) + bilinear(s, t, l0 + 1) * a;
+}
@@ -0,0 +1,74 @@
+#ifndef __TEXTURE_H
+#define __TEXTURE_H
+
+#include <stdint.h>
+
+#include "geom.h"
+
+enum {
+	TEX_RGBA8,  //8 bits per channel, read back as [0, 1]
+	TEX_RGBA32F,
+};
+
+enum {
+	TEX_LINEAR, //rows of interleaved RGBA
+	TEX_TILED,  //4x4 blocks of interleaved RGBA, one cache line at 8 bits
+};
+
+enum {
+	TEX_NEAREST,   //top level only, like the old planar lookups
+	TEX_BILINEAR,  //nearest mip level to the footprint
+	TEX_TRILINEAR, //blend of the two levels around the footprint
+};
+
+#define TEX_BLOCK 4 //offset() assumes 4
+
+//widest and tallest texture accepted; files claiming more are rejected
+#define TEX_MAX_SIZE 32768
+
+//one level of the mip chain; w and h are padded up to whole blocks
+typedef struct {
+	int width, height;
+	int pw, ph;
+	void * data;
+} TexLevel;
+
+//an RGB image with its mip chain, looked up with (s, t) in [0, 1]
+//and a footprint in top-level texels
+class Texture {
+public:
+	Texture();
+	~Texture();
+	//the levels are owned, so a texture is never copied
+	Texture(const Texture &) = delete;
+	Texture & operator=(const Texture &) = delete;
+public:
+	int init(int w, int h, int fmt, int lay);
+	int load_bmp(char * fname, int lay = TEX_TILED);
+	int load_hdr(char * fname, int lay = TEX_TILED);
+	int load_pfm(char * fname, int lay = TEX_TILED);
+	void set(int x, int y, const vec3f & c);
+	void build_mips();
+public:
+	vec3f texel(int level, int x, int y) const;
+	vec3f nearest(float s, float t) const;
+	vec3f bilinear(float s, float t, int level) const;
+	vec3f lookup(float s, float t, float footprint) const;
+	vec3f average() const {return texel(n_levels - 1, 0, 0);}
+public:
+	int width, height;
+	int format, layout, filter;
+	int n_levels;
+	size_t bytes;
+private:
+	size_t offset(const TexLevel * l, int x, int y) const {
+		if (layout == TEX_LINEAR) return (size_t)y * l->pw + x;
+		//x, y >= 0, so shifts and masks stand in for / and %
+		unsigned ux = x, uy = y;
+		return (((size_t)(uy >> 2) * (l->pw >> 2) + (ux >> 2)) << 4) + ((uy & 3) << 2) + (ux & 3);
+	}
+	void release();
+	TexLevel * levels;
+};
+
+#endif
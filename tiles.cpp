@@ -0,0 +1,97 @@
+#include <stdlib.h>
+
+#include "tiles.h"
+
+static unsigned int spread_bits(unsigned int x) {
+	x &= 0xffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+unsigned int morton2(unsigned int x, unsigned int y) {
+	return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+typedef struct {
+	unsigned int code;
+	Tile t;
+} MortonTile;
+
+static int cmp_morton(const void * a, const void * b) {
+	unsigned int ca = ((MortonTile *)a)->code, cb = ((MortonTile *)b)->code;
+	return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+TileQueue::TileQueue(int w, int h, int size, int n_workers, int part, int parts) {
+	int tx = (w + size - 1) / size, ty = (h + size - 1) / size;
+	int all = tx * ty;
+	workers = n_workers;
+
+	MortonTile * order = (MortonTile *)malloc(all * sizeof(MortonTile));
+	for (int j = 0; j < ty; j++) {
+		for (int i = 0; i < tx; i++) {
+			MortonTile * m = &order[j * tx + i];
+			m->code = morton2(i, j);
+			m->t.x0 = i * size; m->t.x1 = (i + 1) * size < w ? (i + 1) * size : w;
+			m->t.y0 = j * size; m->t.y1 = (j + 1) * size < h ? (j + 1) * size : h;
+		}
+	}
+	qsort(order, all, sizeof(MortonTile), cmp_morton);
+
+	tiles = (Tile *)malloc((all > 0 ? all : 1) * sizeof(Tile));
+	count = 0;
+	for (int i = part; i < all; i += parts) tiles[count++] = order[i].t;
+	free(order);
+
+	//contiguous Morton runs keep each worker on a compact patch of the image
+	ranges = new Range[workers];
+	for (int i = 0; i < workers; i++) {
+		ranges[i].head = (int)((long)count * i / workers);
+		ranges[i].tail = (int)((long)count * (i + 1) / workers);
+	}
+}
+
+TileQueue::~TileQueue() {
+	free(tiles);
+	delete[] ranges;
+}
+
+bool TileQueue::next(int worker, Tile * t) {
+	Range * r = &ranges[worker];
+	for (;;) {
+		r->lock.lock();
+		if (r->head < r->tail) {
+			*t = tiles[r->head++];
+			r->lock.unlock();
+			return true;
+		}
+		r->lock.unlock();
+		if (!steal(worker)) return false;
+	}
+}
+
+bool TileQueue::steal(int worker) {
+	for (int k = 1; k < workers; k++) {
+		Range * victim = &ranges[(worker + k) % workers];
+		victim->lock.lock();
+		int left = victim->tail - victim->head;
+		if (left > 0) {
+			//take the back half, rounding up so a single tile can move
+			int mid = victim->tail - (left + 1) / 2;
+			int tail = victim->tail;
+			victim->tail = mid;
+			victim->lock.unlock();
+
+			Range * r = &ranges[worker];
+			r->lock.lock();
+			r->head = mid; r->tail = tail;
+			r->lock.unlock();
+			return true;
+		}
+		victim->lock.unlock();
+	}
+	return false;
+}
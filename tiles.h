@@ -0,0 +1,37 @@
+#ifndef __TILES_H
+#define __TILES_H
+
+#include <mutex>
+
+typedef struct {
+	int x0; int y0; int x1; int y1;
+} Tile;
+
+//tiles are handed out in Morton order; each worker owns a contiguous
+//run of them and steals half of another worker's run when it is out
+class TileQueue {
+public:
+	//only tiles part, part + parts, part + 2 * parts ... of the Morton
+	//order, so a frame split between jobs is shared evenly
+	TileQueue(int w, int h, int size, int n_workers, int part = 0, int parts = 1);
+	~TileQueue();
+public:
+	bool next(int worker, Tile * t);
+public:
+	int count;
+private:
+	bool steal(int worker);
+private:
+	struct alignas(64) Range {
+		std::mutex lock;
+		int head, tail;
+	};
+	Tile * tiles;
+	Range * ranges;
+	int workers;
+};
+
+//interleave the low 16 bits of x and y
+unsigned int morton2(unsigned int x, unsigned int y);
+
+#endif
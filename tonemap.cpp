@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+
+#include "image.h"
+#include "post.h"
+#include "render.h"
+
+void usage() {
+	printf("Usage: tonemap [options] in.pfm|in.rtt out.bmp\n");
+	printf("  -e EV    exposure in stops (default 0)\n");
+	printf("  -m TONE  clamp (default), aces or filmic; the curves add sRGB and dithering\n");
+	printf("  -g       toggle sRGB encoding\n");
+	printf("  -D       toggle dithering\n");
+	printf("  -j N     threads (default: all cores)\n");
+}
+
+static void write_band(ImageFile * out, const float * rgb, int y0, int y1) {
+	out->write_rows(y0, y1, rgb + 3 * (size_t)y0 * out->width);
+}
+
+//re-exposes a float render without tracing it again
+int main(int argc, char** argv) {
+	PostParams p;
+	post_init(&p);
+	int n_threads = std::thread::hardware_concurrency();
+	bool flip_srgb = false, flip_dither = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:m:gDj:h")) != -1) {
+		switch (opt) {
+		case 'e': p.exposure = atof(optarg); break;
+		case 'm': if (post_set_tone(&p, optarg) < 0) {usage(); return -1;} break;
+		case 'g': flip_srgb = true; break;
+		case 'D': flip_dither = true; break;
+		case 'j': n_threads = atoi(optarg); break;
+		default: usage(); return -1;
+		}
+	}
+	if (optind + 2 > argc) {
+		usage();
+		return -1;
+	}
+	if (flip_srgb) p.srgb = !p.srgb;
+	if (flip_dither) p.dither = !p.dither;
+	if (n_threads < 1) n_threads = 1;
+
+	int w, h;
+	double t0 = wall_time();
+	float * rgb = load_image(argv[optind], &w, &h);
+	if (!rgb) return -1;
+	double t1 = wall_time();
+
+	ImageFile out;
+	out.post = p;
+	if (out.open(argv[optind + 1], w, h, 0) < 0) {
+		free(rgb);
+		return -1;
+	}
+	std::thread * pool = new std::thread[n_threads];
+	for (int i = 0; i < n_threads; i++) {
+		int y0 = (int)((long)h * i / n_threads), y1 = (int)((long)h * (i + 1) / n_threads);
+		pool[i] = std::thread(write_band, &out, rgb, y0, y1);
+	}
+	for (int i = 0; i < n_threads; i++) {
+		pool[i].join();
+	}
+	delete[] pool;
+	int ret = out.close();
+	double t2 = wall_time();
+
+	printf("Read %dx%d in %.1f ms, post and write in %.1f ms (%.0f Mpixels/s)\n", w, h,
+		(t1 - t0) * 1e3, (t2 - t1) * 1e3, (double)w * h / (t2 - t1) * 1e-6);
+	free(rgb);
+	return ret;
+}